@@ -0,0 +1,253 @@
+#include <time.h>
+
+#include "collector.h"
+#include "object.h"
+#include "pool.h"
+
+
+struct ModlCollectorBuffer
+{
+  struct ModlObjectReference ** refs;
+  size_t count, capacity;
+};
+
+static struct ModlCollectorBuffer modl_collector_roots = { 0 };
+/* tables still to visit by the phase running */
+static struct ModlCollectorBuffer modl_collector_work = { 0 };
+static struct ModlCollectorBuffer modl_collector_black = { 0 };
+static struct ModlCollectorBuffer modl_collector_garbage = { 0 };
+static struct ModlCollectorStats modl_collector_statistics = { 0 };
+
+
+static inline void modl_collector_push(struct ModlCollectorBuffer * buffer, struct ModlObjectReference * ref)
+{
+  if (buffer->count == buffer->capacity)
+  {
+    buffer->capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 64;
+    buffer->refs = realloc(buffer->refs, buffer->capacity * sizeof (struct ModlObjectReference *));
+  }
+  buffer->refs[buffer->count++] = ref;
+}
+
+static inline struct ModlObjectReference * modl_collector_table(struct ModlObject const * obj)
+{
+  if (ModlTypeTable != modl_object_type(*obj)) return NULL;
+  return modl_to_ref(*obj);
+}
+
+
+void modl_collector_init(size_t capacity)
+{
+  modl_collector_roots.capacity = capacity > 0 ? capacity : 1;
+  modl_collector_roots.refs = malloc(modl_collector_roots.capacity * sizeof (struct ModlObjectReference *));
+}
+
+void modl_collector_free(void)
+{
+  for (size_t i = 0; i < modl_collector_roots.count; ++i)
+    modl_collector_roots.refs[i]->buffered = FALSE;
+
+  free(modl_collector_roots.refs);
+  free(modl_collector_work.refs);
+  free(modl_collector_black.refs);
+  free(modl_collector_garbage.refs);
+  modl_collector_roots = modl_collector_work = modl_collector_black = modl_collector_garbage = (struct ModlCollectorBuffer) { 0 };
+}
+
+bool modl_collector_is_enabled(void)
+{
+  return NULL != modl_collector_roots.refs;
+}
+
+size_t modl_collector_candidates(void)
+{
+  return modl_collector_roots.count;
+}
+
+void modl_collector_possible_root(struct ModlObjectReference * ref)
+{
+  ref->color = ModlColorPurple;
+  if (ref->buffered) return;
+
+  ref->buffered = TRUE;
+  ref->root_index = (uint32_t) modl_collector_roots.count;
+  modl_collector_push(&modl_collector_roots, ref);
+  modl_collector_statistics.candidates += 1;
+}
+
+void modl_collector_free_ref(struct ModlObjectReference * ref)
+{
+  if (ref->buffered)
+  {
+    struct ModlObjectReference * last = modl_collector_roots.refs[--modl_collector_roots.count];
+    modl_collector_roots.refs[ref->root_index] = last;
+    last->root_index = ref->root_index;
+  }
+  modl_pool_free_ref(ref);
+}
+
+
+static void modl_collector_visit_gray(struct ModlObject * obj, void * context)
+{
+  struct ModlObjectReference * ref = modl_collector_table(obj);
+  if (NULL == ref) return;
+
+  ref->count -= 1;
+  if (ModlColorGray == ref->color) return;
+  ref->color = ModlColorGray;
+  modl_collector_push(&modl_collector_work, ref);
+}
+
+/* subtract references between tables reachable from ref */
+static void modl_collector_mark_gray(struct ModlObjectReference * ref)
+{
+  if (ModlColorGray == ref->color) return;
+
+  ref->color = ModlColorGray;
+  modl_collector_push(&modl_collector_work, ref);
+  while (modl_collector_work.count > 0)
+  {
+    struct ModlObjectReference * next = modl_collector_work.refs[--modl_collector_work.count];
+    modl_map_visit(&next->value.table, modl_collector_visit_gray, NULL);
+  }
+}
+
+static void modl_collector_visit_black(struct ModlObject * obj, void * context)
+{
+  struct ModlObjectReference * ref = modl_collector_table(obj);
+  if (NULL == ref) return;
+
+  ref->count += 1;
+  if (ModlColorBlack == ref->color) return;
+  ref->color = ModlColorBlack;
+  modl_collector_push(&modl_collector_black, ref);
+}
+
+/* restore references from ref, which is referenced from outside */
+static void modl_collector_scan_black(struct ModlObjectReference * ref)
+{
+  ref->color = ModlColorBlack;
+  modl_collector_push(&modl_collector_black, ref);
+  while (modl_collector_black.count > 0)
+  {
+    struct ModlObjectReference * next = modl_collector_black.refs[--modl_collector_black.count];
+    modl_map_visit(&next->value.table, modl_collector_visit_black, NULL);
+  }
+}
+
+static void modl_collector_visit_scan(struct ModlObject * obj, void * context)
+{
+  struct ModlObjectReference * ref = modl_collector_table(obj);
+  if (NULL != ref && ModlColorGray == ref->color) modl_collector_push(&modl_collector_work, ref);
+}
+
+static void modl_collector_scan(struct ModlObjectReference * ref)
+{
+  modl_collector_push(&modl_collector_work, ref);
+  while (modl_collector_work.count > 0)
+  {
+    struct ModlObjectReference * next = modl_collector_work.refs[--modl_collector_work.count];
+    if (ModlColorGray != next->color) continue;
+
+    if (next->count > 0)
+    {
+      modl_collector_scan_black(next);
+      continue;
+    }
+
+    next->color = ModlColorWhite;
+    modl_map_visit(&next->value.table, modl_collector_visit_scan, NULL);
+  }
+}
+
+static void modl_collector_visit_white(struct ModlObject * obj, void * context)
+{
+  struct ModlObjectReference * ref = modl_collector_table(obj);
+  if (NULL == ref || ModlColorWhite != ref->color || ref->buffered) return;
+
+  ref->color = ModlColorBlack;
+  modl_collector_push(&modl_collector_work, ref);
+}
+
+static void modl_collector_collect_white(struct ModlObjectReference * ref)
+{
+  if (ModlColorWhite != ref->color || ref->buffered) return;
+
+  ref->color = ModlColorBlack;
+  modl_collector_push(&modl_collector_work, ref);
+  while (modl_collector_work.count > 0)
+  {
+    struct ModlObjectReference * next = modl_collector_work.refs[--modl_collector_work.count];
+    modl_collector_push(&modl_collector_garbage, next);
+    modl_map_visit(&next->value.table, modl_collector_visit_white, NULL);
+  }
+}
+
+/* references to tables were subtracted by the trial deletion */
+static void modl_collector_visit_forget(struct ModlObject * obj, void * context)
+{
+  if (ModlTypeTable == modl_object_type(*obj)) *obj = modl_nil();
+}
+
+
+size_t modl_collector_collect(void)
+{
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  struct ModlCollectorBuffer * roots = &modl_collector_roots;
+  size_t kept = 0;
+  for (size_t i = 0; i < roots->count; ++i)
+  {
+    struct ModlObjectReference * ref = roots->refs[i];
+    if (ModlColorPurple == ref->color && ref->count > 0)
+    {
+      modl_collector_mark_gray(ref);
+      ref->root_index = (uint32_t) kept;
+      roots->refs[kept++] = ref;
+      continue;
+    }
+
+    /* dead tables left the buffer when they were freed, so this one is
+       being disposed and is freed by its release */
+    ref->buffered = FALSE;
+  }
+  roots->count = kept;
+
+  for (size_t i = 0; i < roots->count; ++i)
+    modl_collector_scan(roots->refs[i]);
+
+  for (size_t i = 0; i < roots->count; ++i)
+  {
+    roots->refs[i]->buffered = FALSE;
+    modl_collector_collect_white(roots->refs[i]);
+  }
+  roots->count = 0;
+
+  /* garbage keeps the references to anything but tables */
+  struct ModlCollectorBuffer * garbage = &modl_collector_garbage;
+  for (size_t i = 0; i < garbage->count; ++i)
+    modl_map_visit(&garbage->refs[i]->value.table, modl_collector_visit_forget, NULL);
+  for (size_t i = 0; i < garbage->count; ++i)
+  {
+    modl_map_dispose(&garbage->refs[i]->value.table);
+    modl_pool_free_ref(garbage->refs[i]);
+  }
+
+  size_t const collected = garbage->count;
+  garbage->count = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  uint64_t const pause = (uint64_t) (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+  modl_collector_statistics.collections += 1;
+  modl_collector_statistics.collected += collected;
+  modl_collector_statistics.total_pause += pause;
+  if (pause > modl_collector_statistics.max_pause) modl_collector_statistics.max_pause = pause;
+
+  return collected;
+}
+
+void modl_collector_stats(struct ModlCollectorStats * stats)
+{
+  *stats = modl_collector_statistics;
+}
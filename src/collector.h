@@ -0,0 +1,66 @@
+#pragma once
+
+#include "defs.h"
+
+
+/*
+ *  Backup collector for reference cycles between tables, by synchronous
+ *  trial deletion (Bacon and Rajan, 2001). A table whose count drops to
+ *  a value above zero may have become garbage held only by a cycle, so it
+ *  is colored purple and buffered as a candidate root.
+ *
+ *  A collection subtracts the references between tables reachable from
+ *  the candidates (gray). Tables left with a positive count are referenced
+ *  from outside and are restored along with everything they reach
+ *  (black); the others (white) are garbage and are freed without
+ *  releasing the tables they refer to, whose counts already exclude
+ *  those references.
+ *
+ *  Functions refer to their environment by a plain pointer, environments
+ *  belong to the call stack, so functions cannot be part of a cycle and
+ *  only tables are traversed. A buffered table that dies leaves the buffer
+ *  when its reference is freed.
+ */
+
+struct ModlObjectReference;
+
+struct ModlCollectorStats
+{
+  size_t collections;
+  /* candidates buffered and tables freed as garbage */
+  size_t candidates, collected;
+  /* pause time of collections, in microseconds */
+  uint64_t total_pause, max_pause;
+};
+
+
+/*!
+ *  \brief Buffer candidate roots from now on
+ *  \param capacity Initial size of the buffer
+ */
+void modl_collector_init(size_t capacity);
+void modl_collector_free(void);
+
+bool modl_collector_is_enabled(void);
+size_t modl_collector_candidates(void);
+
+/*!
+ *  \brief Buffer table whose count dropped to a value above zero
+ */
+void modl_collector_possible_root(struct ModlObjectReference * ref);
+
+/*!
+ *  \brief Free reference of a disposed table, removing it from the buffer
+ */
+void modl_collector_free_ref(struct ModlObjectReference * ref);
+
+/*!
+ *  \brief Free cycles of garbage among tables reachable from candidates
+ *
+ *  Must not run while any table is held only by a temporary.
+ *
+ *  \return Number of tables freed
+ */
+size_t modl_collector_collect(void);
+
+void modl_collector_stats(struct ModlCollectorStats * stats);
@@ -50,6 +50,10 @@ ModlOpcode
 
   OP_JCF     = 0x30,
   OP_JCT     = 0x31,
+  OP_CALLW   = 0x32, // call rF with arguments in registers rA .. rA+n-1
+  OP_TBLNEXT = 0x33, // next entry of table rT by cursor rC into rC+1, rC+2, jump when done
+  OP_TBLITER = 0x34, // start iteration of table rT with cursor rC
+  OP_REGION  = 0x35, // allocate objects in a region until the current call returns
 
   OP_POP     = 0x40,
   OP_PUSH    = 0x41,
@@ -65,11 +69,35 @@ ModlOpcode
   OP_ENVUPKT = 0x4B,
   OP_ENVPUSH = 0x4C,
   OP_ENVPOP  = 0x4D,
+  OP_ENVARGC = 0x4E, // bind n-th argument of OP_CALLW to name
+  OP_TBLDELR = 0x4F, // remove key rB from table rA
 
   OP_NOT     = 0x50,
   OP_INV     = 0x51,
   OP_LEN     = 0x52,
   OP_NEG     = 0x53,
+
+  /* quickened variants, rewritten in place by the interpreter */
+  OP_ADD_II    = 0x80,
+  OP_SUB_II    = 0x81,
+  OP_MUL_II    = 0x82,
+  OP_CMPLT_II  = 0x83,
+  OP_CMPNLT_II = 0x84,
+  OP_CMPGT_II  = 0x85,
+  OP_CMPNGT_II = 0x86,
+  OP_CMPLE_II  = 0x87,
+  OP_CMPGE_II  = 0x88,
+
+  OP_ADD_FF    = 0x90,
+  OP_SUB_FF    = 0x91,
+  OP_MUL_FF    = 0x92,
+  OP_DIV_FF    = 0x93,
+  OP_CMPLT_FF  = 0x94,
+  OP_CMPGT_FF  = 0x95,
+  OP_CMPLE_FF  = 0x96,
+  OP_CMPGE_FF  = 0x97,
+
+  OP_ADD_SS    = 0xA0,
 };
 
 static char const * const instructions_names_table[256] =
@@ -118,6 +146,10 @@ static char const * const instructions_names_table[256] =
 
   [0x30] = "JCF",
   [0x31] = "JCT",
+  [0x32] = "CALLW",
+  [0x33] = "TBLNEXT",
+  [0x34] = "TBLITER",
+  [0x35] = "REGION",
 
   [0x40] = "POP",
   [0x41] = "PUSH",
@@ -133,11 +165,34 @@ static char const * const instructions_names_table[256] =
   [0x4B] = "ENVUPKT",
   [0x4C] = "ENVPUSH",
   [0x4D] = "ENVPOP",
+  [0x4E] = "ENVARGC",
+  [0x4F] = "TBLDELR",
 
   [0x50] = "NOT",
   [0x51] = "INV",
   [0x52] = "LEN",
   [0x53] = "NEG",
+
+  [0x80] = "ADD_II",
+  [0x81] = "SUB_II",
+  [0x82] = "MUL_II",
+  [0x83] = "CMPLT_II",
+  [0x84] = "CMPNLT_II",
+  [0x85] = "CMPGT_II",
+  [0x86] = "CMPNGT_II",
+  [0x87] = "CMPLE_II",
+  [0x88] = "CMPGE_II",
+
+  [0x90] = "ADD_FF",
+  [0x91] = "SUB_FF",
+  [0x92] = "MUL_FF",
+  [0x93] = "DIV_FF",
+  [0x94] = "CMPLT_FF",
+  [0x95] = "CMPGT_FF",
+  [0x96] = "CMPLE_FF",
+  [0x97] = "CMPGE_FF",
+
+  [0xA0] = "ADD_SS",
 };
 
 enum __attribute__ ((__packed__))
@@ -170,6 +225,7 @@ struct InstructionParametersTemplate instruction_parameters_templates[256] =
   [OP_TBLGETC] = {{ TP_REGAL, TP_SEBO, }},
 
   [OP_CALLR]   = {{ TP_REGAL, }},
+  [OP_CALLW]   = {{ TP_REGSP, TP_REGAL, }},
   [OP_LOADFUN] = {{ TP_REGAL, TP_INT64, }},
 
   [OP_JMP]     = {{ TP_INT64, }},
@@ -202,12 +258,17 @@ struct InstructionParametersTemplate instruction_parameters_templates[256] =
 
   [OP_JCF]     = {{ TP_REGAL, TP_INT64, }},
   [OP_JCT]     = {{ TP_REGAL, TP_INT64, }},
+  [OP_TBLNEXT] = {{ TP_REGSP, TP_INT64, }},
+  [OP_TBLITER] = {{ TP_REGSP, }},
+
+  [OP_REGION]  = {{ TP_EMPTY, }},
 
   [OP_POP]     = {{ TP_REGAL, }},
   [OP_PUSH]    = {{ TP_REGAL, }},
 
   [OP_TBLPUSH] = {{ TP_REGSP, }},
   [OP_TBLSETR] = {{ TP_REGSP, TP_REGAL, }},
+  [OP_TBLDELR] = {{ TP_REGSP, }},
 
   [OP_ENVGETR] = {{ TP_REGSP, }},
   [OP_ENVGETC] = {{ TP_REGAL, TP_SEBO, }},
@@ -215,26 +276,66 @@ struct InstructionParametersTemplate instruction_parameters_templates[256] =
   [OP_ENVSETC] = {{ TP_REGAL, TP_SEBO, }},
   [OP_ENVUPKR] = {{ TP_REGSP, }},
   [OP_ENVUPKC] = {{ TP_REGAL, TP_SEBO, }},
+  [OP_ENVARGC] = {{ TP_REGAL, TP_SEBO, }},
   [OP_ENVUPKT] = {{ TP_REGAL, }},
 
   [OP_NOT]     = {{ TP_REGAL, }},
   [OP_INV]     = {{ TP_REGAL, }},
   [OP_LEN]     = {{ TP_REGAL, }},
   [OP_NEG]     = {{ TP_REGAL, }},
+
+  [OP_ADD_II]    = {{ TP_REGSP, }},
+  [OP_SUB_II]    = {{ TP_REGSP, }},
+  [OP_MUL_II]    = {{ TP_REGSP, }},
+  [OP_CMPLT_II]  = {{ TP_REGSP, }},
+  [OP_CMPNLT_II] = {{ TP_REGSP, }},
+  [OP_CMPGT_II]  = {{ TP_REGSP, }},
+  [OP_CMPNGT_II] = {{ TP_REGSP, }},
+  [OP_CMPLE_II]  = {{ TP_REGSP, }},
+  [OP_CMPGE_II]  = {{ TP_REGSP, }},
+
+  [OP_ADD_FF]    = {{ TP_REGSP, }},
+  [OP_SUB_FF]    = {{ TP_REGSP, }},
+  [OP_MUL_FF]    = {{ TP_REGSP, }},
+  [OP_DIV_FF]    = {{ TP_REGSP, }},
+  [OP_CMPLT_FF]  = {{ TP_REGSP, }},
+  [OP_CMPGT_FF]  = {{ TP_REGSP, }},
+  [OP_CMPLE_FF]  = {{ TP_REGSP, }},
+  [OP_CMPGE_FF]  = {{ TP_REGSP, }},
+
+  [OP_ADD_SS]    = {{ TP_REGSP, }},
 };
 
 
 #define INSTRUCTION_TEMPLATE_VALUES_COUNT 2
 
+#define INSTRUCTION_FLAG_GENERIC 0x01
+
+/*!
+ *  \brief Pre-decoded instruction
+ *
+ *  Bytecode is translated once at load time into a dense array of these.
+ *  TP_INT64 operands are code addresses and hold the index of the target
+ *  instruction, TP_SEBO operands hold an index into the constant pool and,
+ *  for instructions with an inline cache, the index of the cache entry.
+ *  Arithmetic and comparison instructions may have their opcode rewritten
+ *  to a quickened variant; INSTRUCTION_FLAG_GENERIC marks sites that failed
+ *  a guard and stay generic.
+ */
 struct Instruction
 {
   enum ModlOpcode opcode;
-  size_t byte_length;
+  byte flags;
+  uint32_t offset;
 
   union
   {
     int64_t i64;
     byte r[2];
-    struct ModlObject object;
+    struct
+    {
+      uint32_t constant;
+      uint32_t cache;
+    };
   } a[INSTRUCTION_TEMPLATE_VALUES_COUNT];
 };
@@ -1,207 +1,1161 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "map.h"
 #include "object.h"
 
 
+/* metadata of slots that hold no entry; full slots store 7 bits of hash */
+#define CTRL_EMPTY   ((int8_t) -128)
+#define CTRL_DELETED ((int8_t) -2)
+
+#define SLOT_NOT_FOUND UINT32_MAX
+
+
+
+bool modl_map_incremental_resize = FALSE;
+
+/* shape of maps without string keys, never released */
+static struct ModlShape modl_shape_root = { .refs = 1 };
+
+/* fields of maps with the root shape, shared until the first key is added */
+static struct ModlMapFields modl_map_root_fields = { .shape = &modl_shape_root };
+
+
+static inline uint64_t modl_map_hash(struct ModlObject key)
+{
+    /* spread the object hash over the bits taken by h1 and h2 */
+    uint64_t h = (uint64_t) modl_object_hash(key) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 32);
+}
+
+static inline uint32_t modl_map_h1(uint64_t hash) { return (uint32_t) hash; }
+static inline int8_t modl_map_h2(uint64_t hash) { return (int8_t) (hash >> 57); }
+
+static inline uint32_t modl_map_max_load(uint32_t capacity)
+{
+    return capacity - capacity / 8;
+}
+
+/* number of entries in the hash part */
+static inline uint32_t modl_map_hash_size(struct ModlMap const * self)
+{
+    return self->size - (self->array_size - self->array_holes) - (NULL != self->fields ? self->fields->size : 0);
+}
+
+/* number of entries in the current slots, without ones left to migrate */
+static inline uint32_t modl_map_slots_size(struct ModlMap const * self)
+{
+    return modl_map_hash_size(self) - (NULL != self->resize ? self->resize->size : 0);
+}
+
+static inline bool modl_map_is_array_index(struct ModlObject key, uint32_t limit)
+{
+    return ModlTypeInteger == modl_object_type(key) && modl_to_int(key) >= 0 && modl_to_int(key) < (int64_t) limit;
+}
+
+#ifdef __SSE2__
+/* bit i is set if metadata of slot i of the group equals byte */
+static inline uint32_t modl_map_group_match(int8_t const * ctrl, int8_t byte)
+{
+    __m128i group = _mm_loadu_si128((__m128i const *) ctrl);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+}
+
+/* bit i is set if slot i of the group is empty or deleted */
+static inline uint32_t modl_map_group_match_free(int8_t const * ctrl)
+{
+    return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((__m128i const *) ctrl));
+}
+#else
+static inline uint32_t modl_map_group_match(int8_t const * ctrl, int8_t byte)
+{
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < MODL_MAP_GROUP_WIDTH; ++i)
+        mask |= (uint32_t) (ctrl[i] == byte) << i;
+    return mask;
+}
+
+static inline uint32_t modl_map_group_match_free(int8_t const * ctrl)
+{
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < MODL_MAP_GROUP_WIDTH; ++i)
+        mask |= (uint32_t) (ctrl[i] < 0) << i;
+    return mask;
+}
+#endif
+
+static inline void modl_map_set_ctrl(int8_t * ctrl, uint32_t capacity, uint32_t slot, int8_t value)
+{
+    uint32_t const mask = capacity - 1;
+    ctrl[slot] = value;
+    ctrl[((slot - MODL_MAP_GROUP_WIDTH) & mask) + MODL_MAP_GROUP_WIDTH] = value;
+}
+
+static inline enum ModlMapKeys modl_map_key_kind(struct ModlObject key)
+{
+    switch (modl_object_type(key))
+    {
+        case ModlTypeInteger: return ModlMapKeysInteger;
+        case ModlTypeString: return ModlMapKeysString;
+        default: return ModlMapKeysGeneric;
+    }
+}
+
+/* whether a key of this type can be in the hash part */
+static inline bool modl_map_may_hold(struct ModlMap const * self, struct ModlObject key)
+{
+    return ModlMapKeysGeneric == self->keys || modl_map_key_kind(key) == self->keys;
+}
+
+static inline __attribute__((always_inline))
+bool modl_map_key_equals(enum ModlMapKeys keys, struct ModlObject key, struct ModlObject other)
+{
+    switch (keys)
+    {
+        case ModlMapKeysInteger:
+            return modl_to_int(key) == modl_to_int(other);
+
+        /* strings always carry their hash, compared before the characters */
+        case ModlMapKeysString:
+            return modl_to_ref(key) == modl_to_ref(other)
+                || (modl_to_ref(key)->hash == modl_to_ref(other)->hash
+                    && 0 == strcmp(modl_to_ref(key)->value.string, modl_to_ref(other)->value.string));
+
+        default:
+            return modl_object_equals(key, other);
+    }
+}
+
+/*
+ *  Groups are probed triangularly: pos, pos + 16, pos + 48, ... which
+ *  visits every group of a power of two capacity.
+ */
+static inline __attribute__((always_inline))
+uint32_t modl_map_find_keys(enum ModlMapKeys keys, int8_t const * ctrl, struct ModlMapBucket const * vec,
+                            uint32_t capacity, struct ModlObject key, uint64_t hash)
+{
+    uint32_t const mask = capacity - 1;
+    int8_t const h2 = modl_map_h2(hash);
+    uint32_t pos = modl_map_h1(hash) & mask;
+
+    for (uint32_t stride = MODL_MAP_GROUP_WIDTH; ; stride += MODL_MAP_GROUP_WIDTH)
+    {
+        int8_t const * group = &ctrl[pos];
+        for (uint32_t match = modl_map_group_match(group, h2); match; match &= match - 1)
+        {
+            uint32_t const slot = (pos + __builtin_ctz(match)) & mask;
+            if (modl_map_key_equals(keys, key, vec[slot].key))
+                return slot;
+        }
+
+        /* entry would have been put into an empty slot of this group */
+        if (modl_map_group_match(group, CTRL_EMPTY))
+            return SLOT_NOT_FOUND;
+
+        pos = (pos + stride) & mask;
+    }
+}
+
+static uint32_t modl_map_find(enum ModlMapKeys keys, int8_t const * ctrl, struct ModlMapBucket const * vec,
+                              uint32_t capacity, struct ModlObject key, uint64_t hash)
+{
+    switch (keys)
+    {
+        case ModlMapKeysInteger: return modl_map_find_keys(ModlMapKeysInteger, ctrl, vec, capacity, key, hash);
+        case ModlMapKeysString: return modl_map_find_keys(ModlMapKeysString, ctrl, vec, capacity, key, hash);
+        default: return modl_map_find_keys(ModlMapKeysGeneric, ctrl, vec, capacity, key, hash);
+    }
+}
+
+static uint32_t modl_map_find_free(struct ModlMap const * self, uint64_t hash)
+{
+    uint32_t const mask = self->capacity - 1;
+    uint32_t pos = modl_map_h1(hash) & mask;
+
+    for (uint32_t stride = MODL_MAP_GROUP_WIDTH; ; stride += MODL_MAP_GROUP_WIDTH)
+    {
+        uint32_t const match = modl_map_group_match_free(&self->ctrl[pos]);
+        if (match)
+            return (pos + __builtin_ctz(match)) & mask;
+
+        pos = (pos + stride) & mask;
+    }
+}
+
+/*!
+ *  \brief Find the field of a key
+ *  \param self Shape
+ *  \param key Key
+ *  \return Slot of the field, UINT32_MAX if the shape has no such key
+ */
+uint32_t modl_shape_find(struct ModlShape const * self, struct ModlObject key)
+{
+    if (ModlTypeString != modl_object_type(key))
+        return SLOT_NOT_FOUND;
+
+    for (uint32_t i = 0; i < self->count; ++i)
+    {
+        if (modl_map_key_equals(ModlMapKeysString, key, self->keys[i]))
+            return i;
+    }
+
+    return SLOT_NOT_FOUND;
+}
+
+void modl_shape_take(struct ModlShape * self)
+{
+    self->refs += 1;
+}
+
+/*!
+ *  \brief Drop a reference to the shape, freeing it and the parents no
+ *         longer used
+ *  \param self Shape
+ */
+void modl_shape_release(struct ModlShape * self)
+{
+    while (0 == --self->refs)
+    {
+        struct ModlShape * parent = self->parent;
+        struct ModlShape ** link = &parent->children;
+        while (*link != self)
+            link = &(*link)->sibling;
+        *link = self->sibling;
+
+        for (uint32_t i = 0; i < self->count; ++i)
+            modl_object_release(self->keys[i]);
+        free(self);
+
+        self = parent;
+    }
+}
+
+/* shape with the key added after the keys of self, shared by all maps
+   adding it */
+static struct ModlShape * modl_shape_add(struct ModlShape * self, struct ModlObject key)
+{
+    for (struct ModlShape * child = self->children; NULL != child; child = child->sibling)
+    {
+        if (modl_map_key_equals(ModlMapKeysString, key, child->keys[self->count]))
+            return child;
+    }
+
+    struct ModlShape * child = malloc(sizeof (struct ModlShape) + (self->count + 1) * sizeof (struct ModlObject));
+    child->parent = self;
+    child->children = NULL;
+    child->sibling = self->children;
+    child->refs = 0;
+    child->count = self->count + 1;
+    for (uint32_t i = 0; i < self->count; ++i)
+        child->keys[i] = modl_object_take(self->keys[i]);
+    child->keys[self->count] = modl_object_take(key);
+
+    self->children = child;
+    modl_shape_take(self);
+    return child;
+}
+
+/* smallest capacity holding count entries */
+static uint32_t modl_map_capacity_for(size_t count)
+{
+    uint32_t capacity = MODL_MAP_GROUP_WIDTH;
+    while (modl_map_max_load(capacity) < count)
+        capacity *= 2;
+    return capacity;
+}
+
+static void modl_map_allocate(struct ModlMap * self, uint32_t capacity)
+{
+    self->capacity = capacity;
+    self->tombstones = 0;
+    self->ctrl = malloc(capacity + MODL_MAP_GROUP_WIDTH);
+    memset(self->ctrl, CTRL_EMPTY, capacity + MODL_MAP_GROUP_WIDTH);
+    self->vec = malloc(capacity * sizeof (struct ModlMapBucket));
+}
+
+/* free fields unless they are the shared ones of the root shape */
+static void modl_map_free_fields(struct ModlMapFields * fields)
+{
+    if (&modl_map_root_fields != fields)
+        free(fields);
+}
+
+
 struct ModlMap *modl_map_init(struct ModlMap *self, size_t initial_size)
 {
-    self->vec = calloc(initial_size, sizeof(struct ModlMapBucket));
-    self->capacity = initial_size;
+    self->capacity = 0;
     self->size = 0;
+    self->tombstones = 0;
+    self->keys = ModlMapKeysNone;
+    self->shrink_pending = FALSE;
+    self->incremental = modl_map_incremental_resize;
+    self->iterating = FALSE;
+    self->ctrl = NULL;
+    self->vec = NULL;
+    self->array = NULL;
+    self->array_size = 0;
+    self->array_capacity = 0;
+    self->array_holes = 0;
+    self->resize = NULL;
+    self->fields = NULL;
+
+    /* empty maps allocate on the first insert */
+    if (0 == initial_size)
+        return self;
+
+    modl_map_allocate(self, modl_map_capacity_for(initial_size));
 
     return self;
 }
 
 void modl_map_dispose(struct ModlMap *self)
 {
-    // modl_map_print(self);
-    
-    for (uint32_t i = 0; i < self->capacity; ++i)
+    uint64_t cursor = 0;
+    while (modl_map_dispose_step(self, &cursor, UINT32_MAX));
+}
+
+bool modl_map_dispose_step(struct ModlMap * self, uint64_t * cursor, uint32_t count)
+{
+    /* the cursor walks the slots, the old slots, the array part and the
+       fields one after another */
+    struct ModlMapResize * const resize = self->resize;
+    struct ModlMapFields * const fields = self->fields;
+    uint64_t const old_start = self->capacity;
+    uint64_t const array_start = old_start + (NULL != resize ? resize->capacity : 0);
+    uint64_t const fields_start = array_start + self->array_size;
+    uint64_t const end = fields_start + (NULL != fields ? fields->shape->count : 0);
+
+    for (uint64_t stop = *cursor + count; *cursor < end && *cursor < stop; *cursor += 1)
     {
-        // printf("removing %d bucket\n", i);
-        struct ModlMapBucket * b = &self->vec[i];
-        modl_object_release(b->obj);
-        modl_object_release(b->key);
-        b = b->next;
-        while (NULL != b)
+        uint64_t const i = *cursor;
+        if (i < old_start)
         {
-            if (b->next)
-            {
-                modl_object_release(b->obj);
-                modl_object_release(b->key);
-            }
-            struct ModlMapBucket *tmp = b;
-            b = b->next;
-            free(tmp);
+            if (self->ctrl[i] < 0) continue;
+
+            modl_object_release(self->vec[i].obj);
+            modl_object_release(self->vec[i].key);
         }
+        else if (i < array_start)
+        {
+            uint64_t const j = i - old_start;
+            if (j < resize->migrated || resize->ctrl[j] < 0) continue;
+
+            modl_object_release(resize->vec[j].obj);
+            modl_object_release(resize->vec[j].key);
+        }
+        else if (i < fields_start) modl_object_release(self->array[i - array_start]);
+        else modl_object_release(fields->values[i - fields_start]);
+    }
+
+    if (*cursor < end) return TRUE;
+
+    if (NULL != resize)
+    {
+        free(resize->ctrl);
+        free(resize->vec);
+        free(resize);
     }
-    
+
+    if (NULL != fields)
+    {
+        modl_shape_release(fields->shape);
+        modl_map_free_fields(fields);
+    }
+
+    free(self->ctrl);
     free(self->vec);
+    free(self->array);
     // DO NOT!!!
     // free(self);
+    return FALSE;
+}
+
+void modl_map_visit(struct ModlMap * self, void (* visit)(struct ModlObject * obj, void * context), void * context)
+{
+    for (uint32_t i = 0; i < self->capacity; ++i)
+    {
+        if (self->ctrl[i] < 0) continue;
+
+        visit(&self->vec[i].obj, context);
+        visit(&self->vec[i].key, context);
+    }
+
+    struct ModlMapResize * const resize = self->resize;
+    for (uint32_t i = NULL != resize ? resize->migrated : 0; NULL != resize && i < resize->capacity; ++i)
+    {
+        if (resize->ctrl[i] < 0) continue;
+
+        visit(&resize->vec[i].obj, context);
+        visit(&resize->vec[i].key, context);
+    }
+
+    for (uint32_t i = 0; i < self->array_size; ++i)
+        visit(&self->array[i], context);
+
+    for (uint32_t i = 0; NULL != self->fields && i < self->fields->shape->count; ++i)
+        visit(&self->fields->values[i], context);
 }
 
+/* move up to count old slots to the current ones, dropping the old slots
+   once all entries are moved */
+static void modl_map_migrate(struct ModlMap * self, uint32_t count)
+{
+    struct ModlMapResize * const resize = self->resize;
+    uint32_t const end = count < resize->capacity - resize->migrated ? resize->migrated + count : resize->capacity;
+
+    for (; resize->migrated < end && 0 != resize->size; ++resize->migrated)
+    {
+        uint32_t const i = resize->migrated;
+        if (resize->ctrl[i] < 0) continue;
+
+        uint64_t const hash = modl_map_hash(resize->vec[i].key);
+        uint32_t const slot = modl_map_find_free(self, hash);
+        if (CTRL_DELETED == self->ctrl[slot])
+            self->tombstones -= 1;
+
+        modl_map_set_ctrl(self->ctrl, self->capacity, slot, modl_map_h2(hash));
+        self->vec[slot] = resize->vec[i];
+        modl_map_set_ctrl(resize->ctrl, resize->capacity, i, CTRL_DELETED);
+        resize->size -= 1;
+    }
+
+    if (0 == resize->size)
+    {
+        free(resize->ctrl);
+        free(resize->vec);
+        free(resize);
+        self->resize = NULL;
+    }
+}
+
+/* move the hash part to new slots of the given capacity */
+static struct ModlMap * modl_map_rehash(struct ModlMap * self, uint32_t capacity)
+{
+    /* a resize still in progress is finished first */
+    if (NULL != self->resize)
+        modl_map_migrate(self, UINT32_MAX);
+
+    struct ModlMapResize * const resize = malloc(sizeof (struct ModlMapResize));
+    resize->ctrl = self->ctrl;
+    resize->vec = self->vec;
+    resize->capacity = self->capacity;
+    resize->size = modl_map_hash_size(self);
+    resize->migrated = 0;
+
+    modl_map_allocate(self, capacity);
+    self->resize = resize;
+
+    if (not self->incremental)
+        modl_map_migrate(self, UINT32_MAX);
+
+    return self;
+}
+
+/*!
+ *  \brief Rebuild map without tombstones, doubling capacity if it is more
+ *         than half full
+ *
+ *  Incremental maps only allocate the new slots here, entries are moved
+ *  by the following operations.
+ */
 struct ModlMap * modl_map_resize(struct ModlMap * self)
 {
-    // printf("%s\n", "BEFORE REALLOC:");
-    // modl_map_print(self);
-    // printf("%c", '\n');
+    uint32_t capacity = self->capacity;
+    if (0 == capacity)
+        capacity = MODL_MAP_GROUP_WIDTH;
+    else if (2 * (modl_map_hash_size(self) + 1) > modl_map_max_load(capacity))
+        capacity *= 2;
+
+    return modl_map_rehash(self, capacity);
+}
+
+/* make room for count fields */
+static void modl_map_reserve_fields(struct ModlMap * self, uint32_t count)
+{
+    if (count <= self->fields->capacity)
+        return;
 
-    uint32_t old_capacity = self->capacity;
-    self->capacity *= 2;
-    self->vec = realloc(self->vec, sizeof(struct ModlMapBucket) * self->capacity);
-    // zero memory after reallocation
-    memset(&self->vec[old_capacity], 0, old_capacity * sizeof (struct ModlMapBucket));
+    uint32_t capacity = self->fields->capacity ? 2 * self->fields->capacity : 4;
+    while (capacity < count)
+        capacity *= 2;
 
-    // printf("increasing capacity from %d to %d\n", old_capacity, self->capacity);
+    bool const shared = &modl_map_root_fields == self->fields;
+    self->fields = realloc(shared ? NULL : self->fields, sizeof (struct ModlMapFields) + capacity * sizeof (struct ModlObject));
+    if (shared)
+        *self->fields = modl_map_root_fields;
+    self->fields->capacity = capacity;
+}
 
-    for (uint32_t i = 0; i < old_capacity; ++i)
+/*!
+ *  \brief Make room so entries can be added without reallocation
+ *  \param self Map
+ *  \param array_count Number of values to be appended to the array part
+ *  \param hash_count Number of entries to be added to the hash part
+ */
+void modl_map_reserve(struct ModlMap * self, size_t array_count, size_t hash_count)
+{
+    if (self->array_size + array_count > self->array_capacity)
+    {
+        self->array_capacity = self->array_size + array_count;
+        self->array = realloc(self->array, self->array_capacity * sizeof (struct ModlObject));
+    }
+
+    if (NULL != self->fields)
     {
-        struct ModlMapBucket *bkt_prev = NULL;
-        struct ModlMapBucket *bkt = &self->vec[i];
+        size_t const fields = self->fields->shape->count + hash_count;
+        modl_map_reserve_fields(self, fields < MODL_SHAPE_MAX_FIELDS ? fields : MODL_SHAPE_MAX_FIELDS);
+        return;
+    }
+
+    size_t const count = modl_map_slots_size(self) + self->tombstones + hash_count;
+    if (0 != hash_count && count > modl_map_max_load(self->capacity))
+        modl_map_rehash(self, modl_map_capacity_for(modl_map_hash_size(self) + hash_count));
+}
+
+/* advance a resize in progress by one step */
+static inline void modl_map_migrate_step(struct ModlMap * self)
+{
+    if (NULL != self->resize)
+        modl_map_migrate(self, MODL_MAP_MIGRATION_STEP);
+}
+
+/* bucket of the key in the current or the old slots */
+static struct ModlMapBucket * modl_map_hash_find(struct ModlMap * self, struct ModlObject key, uint64_t hash)
+{
+    uint32_t slot = modl_map_find(self->keys, self->ctrl, self->vec, self->capacity, key, hash);
+    if (SLOT_NOT_FOUND != slot)
+        return &self->vec[slot];
 
-        while (bkt->next)
+    struct ModlMapResize const * const resize = self->resize;
+    if (NULL == resize)
+        return NULL;
+
+    slot = modl_map_find(self->keys, resize->ctrl, resize->vec, resize->capacity, key, hash);
+    return SLOT_NOT_FOUND != slot ? &resize->vec[slot] : NULL;
+}
+
+/* take the entry out of the hash part, passing its value to the caller */
+static bool modl_map_hash_extract(struct ModlMap * self, struct ModlObject key, struct ModlObject * val)
+{
+    if (0 == modl_map_hash_size(self) || not modl_map_may_hold(self, key))
+        return FALSE;
+
+    modl_map_migrate_step(self);
+
+    uint64_t const hash = modl_map_hash(key);
+    uint32_t const slot = modl_map_find(self->keys, self->ctrl, self->vec, self->capacity, key, hash);
+    if (SLOT_NOT_FOUND == slot)
+    {
+        struct ModlMapResize * const resize = self->resize;
+        if (NULL == resize)
+            return FALSE;
+
+        /* old slots are only read until migrated, any free mark will do */
+        uint32_t const old_slot = modl_map_find(self->keys, resize->ctrl, resize->vec, resize->capacity, key, hash);
+        if (SLOT_NOT_FOUND == old_slot)
+            return FALSE;
+
+        struct ModlMapBucket const removed = resize->vec[old_slot];
+        modl_map_set_ctrl(resize->ctrl, resize->capacity, old_slot, CTRL_DELETED);
+        resize->size -= 1;
+        self->size -= 1;
+
+        modl_object_release(removed.key);
+        *val = removed.obj;
+        return TRUE;
+    }
+
+    struct ModlMapBucket const removed = self->vec[slot];
+    self->size -= 1;
+
+    /* the slot can become empty again only if no probe sequence passed a
+       full group through it */
+    uint32_t const mask = self->capacity - 1;
+    uint32_t const empty_before = modl_map_group_match(&self->ctrl[(slot - MODL_MAP_GROUP_WIDTH) & mask], CTRL_EMPTY);
+    uint32_t const empty_after = modl_map_group_match(&self->ctrl[slot], CTRL_EMPTY);
+    if (empty_before && empty_after
+        && (uint32_t) (__builtin_clz(empty_before) - (32 - MODL_MAP_GROUP_WIDTH)) + __builtin_ctz(empty_after) < MODL_MAP_GROUP_WIDTH)
+    {
+        modl_map_set_ctrl(self->ctrl, self->capacity, slot, CTRL_EMPTY);
+    }
+    else
+    {
+        modl_map_set_ctrl(self->ctrl, self->capacity, slot, CTRL_DELETED);
+        self->tombstones += 1;
+    }
+
+    modl_object_release(removed.key);
+    *val = removed.obj;
+    return TRUE;
+}
+
+/* rebuild the hash part smaller once less than a quarter of it is used */
+static void modl_map_hash_shrink(struct ModlMap * self)
+{
+    self->shrink_pending = FALSE;
+
+    uint32_t const hash_size = modl_map_hash_size(self);
+    if (NULL != self->resize || self->capacity <= MODL_MAP_GROUP_WIDTH
+        || hash_size >= modl_map_max_load(self->capacity) / MODL_MAP_SHRINK_RATIO)
+        return;
+
+    modl_map_rehash(self, modl_map_capacity_for(2 * (hash_size + 1)));
+}
+
+/*!
+ *  \brief Set the value of a field of the map's shape
+ *  \param self Map using a shape
+ *  \param slot Slot of the key in the shape
+ *  \param val Value
+ */
+void modl_map_set_field(struct ModlMap * self, uint32_t slot, struct ModlObject val)
+{
+    if (NULL == modl_map_field(self, slot))
+    {
+        self->size += 1;
+        self->fields->size += 1;
+    }
+
+    modl_object_take(val);
+    modl_object_release(self->fields->values[slot]);
+    self->fields->values[slot] = val;
+}
+
+/*!
+ *  \brief Add the last key of a shape to the map
+ *  \param self Map using a shape
+ *  \param target Shape adding one key to the map's shape
+ *  \param val Value of the key
+ */
+void modl_map_add_field(struct ModlMap * self, struct ModlShape * target, struct ModlObject val)
+{
+    modl_map_reserve_fields(self, target->count);
+    self->fields->values[target->count - 1] = modl_object_take(val);
+    self->size += 1;
+    self->fields->size += 1;
+
+    modl_shape_take(target);
+    modl_shape_release(self->fields->shape);
+    self->fields->shape = target;
+}
+
+/* store the entry in a field, FALSE if the shape cannot hold the key */
+static bool modl_map_shape_set(struct ModlMap * self, struct ModlObject key, struct ModlObject val)
+{
+    if (ModlTypeString != modl_object_type(key))
+        return FALSE;
+
+    struct ModlShape * const shape = self->fields->shape;
+    uint32_t const slot = modl_shape_find(shape, key);
+    if (SLOT_NOT_FOUND != slot)
+    {
+        modl_map_set_field(self, slot, val);
+        return TRUE;
+    }
+
+    if (MODL_SHAPE_MAX_FIELDS == shape->count)
+        return FALSE;
+
+    modl_map_add_field(self, modl_shape_add(shape, key), val);
+    return TRUE;
+}
+
+/* move the fields to the hash part, the map stops using shapes */
+static void modl_map_drop_shape(struct ModlMap * self)
+{
+    struct ModlMapFields * const fields = self->fields;
+    struct ModlShape * const shape = fields->shape;
+
+    /* the hash part is not allocated while the map uses a shape, the
+       entries are counted by it from now on */
+    self->fields = NULL;
+    self->keys = ModlMapKeysString;
+    modl_map_allocate(self, modl_map_capacity_for(fields->size));
+
+    for (uint32_t i = 0; i < shape->count; ++i)
+    {
+        if (modl_object_is_unbound(fields->values[i])) continue;
+
+        uint64_t const hash = modl_map_hash(shape->keys[i]);
+        uint32_t const slot = modl_map_find_free(self, hash);
+        modl_map_set_ctrl(self->ctrl, self->capacity, slot, modl_map_h2(hash));
+        self->vec[slot] = (struct ModlMapBucket) {
+            .key = modl_object_take(shape->keys[i]),
+            .obj = fields->values[i],
+        };
+    }
+
+    modl_map_free_fields(fields);
+    modl_shape_release(shape);
+}
+
+static void modl_map_hash_set(struct ModlMap * self, struct ModlObject key, struct ModlObject val)
+{
+    if (NULL != self->fields)
+    {
+        if (modl_map_shape_set(self, key, val))
+            return;
+
+        modl_map_drop_shape(self);
+    }
+
+    uint64_t const hash = modl_map_hash(key);
+
+    if (0 != modl_map_hash_size(self) && modl_map_may_hold(self, key))
+    {
+        modl_map_migrate_step(self);
+
+        struct ModlMapBucket * bucket = modl_map_hash_find(self, key, hash);
+        if (NULL != bucket)
         {
-            struct ModlMapBucket * next_bucket = bkt->next;
-
-            uint32_t new_index = modl_object_hash(bkt->key) % self->capacity;
-            // printf("  index change from %d to %d\n", i, new_index);
-            // printf("  changing key ");
-            // modl_object_display(&bkt->key);
-            // printf(" with hash=%u and index=%u->%u\n", modl_object_hash(bkt->key), i, new_index);
-            if (new_index != i)
-            {
-                // printf("%s\n", "    moving!");
-
-                struct ModlMapBucket tmp_obj;
-                tmp_obj = self->vec[new_index];  // [OB] [NB] [tmp_object = NB]
-                self->vec[new_index] = *bkt;     // [NB = OB]
-
-                if (NULL == bkt_prev)
-                {
-                    struct ModlMapBucket * tmp_ref = bkt->next;
-                    self->vec[i] = *bkt->next;
-                    next_bucket = &self->vec[i];
-                    bkt = tmp_ref;
-                }
-                else
-                {
-                    // [OB->...->_remove_->next ]
-                    bkt_prev->next = bkt->next;
-                }
-
-                *bkt = tmp_obj;
-                self->vec[new_index].next = bkt;
-            }
-            else
-            {
-                bkt_prev = bkt;
-            }
-
-            bkt = next_bucket;
+            modl_object_take(val);
+            modl_object_release(bucket->obj);
+            bucket->obj = val;
+            return;
         }
     }
 
-    // printf("%s\n", "AFTER REALLOC:");
-    // modl_map_print(self);
-    // printf("%c", '\n');
+    /* inserting may rehash anyway, so a shrink deferred by an iteration
+       is done here */
+    if (self->shrink_pending)
+        modl_map_hash_shrink(self);
 
-    return self;
+    enum ModlMapKeys const kind = modl_map_key_kind(key);
+    if (0 == modl_map_hash_size(self))
+        self->keys = kind;
+    else if (kind != self->keys)
+        self->keys = ModlMapKeysGeneric;
+
+    if (modl_map_slots_size(self) + self->tombstones + 1 > modl_map_max_load(self->capacity))
+        modl_map_resize(self);
+
+    uint32_t const slot = modl_map_find_free(self, hash);
+    if (CTRL_DELETED == self->ctrl[slot])
+        self->tombstones -= 1;
+
+    self->size += 1;
+    modl_map_set_ctrl(self->ctrl, self->capacity, slot, modl_map_h2(hash));
+    self->vec[slot] = (struct ModlMapBucket) {
+        .key = modl_object_take(key),
+        .obj = modl_object_take(val),
+    };
 }
 
-struct ModlObject * modl_map_get(struct ModlMap *self, struct ModlObject key)
+/* append to the array part and move the keys that now continue it out of
+   the hash part */
+static void modl_map_array_append(struct ModlMap * self, struct ModlObject val)
 {
-    unsigned int hash = modl_object_hash(key);
-    // printf("getting key ");
-    // modl_object_display(&key);
-    // printf(" with hash=%u and index=%u\n", hash, hash % self->capacity);
-    hash %= self->capacity;
+    if (self->array_size == self->array_capacity)
+    {
+        self->array_capacity = self->array_capacity ? 2 * self->array_capacity : 4;
+        self->array = realloc(self->array, self->array_capacity * sizeof (struct ModlObject));
+    }
 
-    struct ModlMapBucket *bkt_iter = &self->vec[hash];
+    self->array[self->array_size++] = modl_object_take(val);
+    self->size += 1;
 
-    while (bkt_iter->next)
+    struct ModlObject moved;
+    while (modl_map_hash_extract(self, int_to_modl(self->array_size), &moved))
     {
-        if (modl_object_equals(key, bkt_iter->key))
+        if (self->array_size == self->array_capacity)
         {
-            // printf("%s", "  found! ");
-            // modl_object_display(&bkt_iter->obj);
-            // printf("%c", '\n');
-            return &bkt_iter->obj;
+            self->array_capacity *= 2;
+            self->array = realloc(self->array, self->array_capacity * sizeof (struct ModlObject));
         }
 
-        bkt_iter = bkt_iter->next;
+        /* extraction counted the entry out, it stays in the map */
+        self->array[self->array_size++] = moved;
+        self->size += 1;
     }
+}
 
-    return NULL;
+struct ModlObject * modl_map_get(struct ModlMap *self, struct ModlObject key)
+{
+    if (modl_map_is_array_index(key, self->array_size))
+    {
+        struct ModlObject * const entry = &self->array[modl_to_int(key)];
+        return modl_object_is_unbound(*entry) ? NULL : entry;
+    }
+
+    if (NULL != self->fields)
+    {
+        uint32_t const slot = modl_shape_find(self->fields->shape, key);
+        return SLOT_NOT_FOUND != slot ? modl_map_field(self, slot) : NULL;
+    }
+
+    if (0 == modl_map_hash_size(self) || not modl_map_may_hold(self, key))
+        return NULL;
+
+    modl_map_migrate_step(self);
+
+    struct ModlMapBucket * bucket = modl_map_hash_find(self, key, modl_map_hash(key));
+    return NULL != bucket ? &bucket->obj : NULL;
 }
 
 void modl_map_print(struct ModlMap * self)
 {
     printf("%s", "[ ");
+    for (uint32_t i = 0; i < self->array_size; ++i)
+    {
+        if (modl_object_is_unbound(self->array[i])) continue;
+
+        struct ModlObject const key = int_to_modl(i);
+        modl_object_display(&key);
+        printf("%s", ": ");
+        modl_object_display(&self->array[i]);
+        printf("%s", ", ");
+    }
+    for (uint32_t i = 0; NULL != self->fields && i < self->fields->shape->count; ++i)
+    {
+        if (NULL == modl_map_field(self, i)) continue;
+
+        modl_object_display(&self->fields->shape->keys[i]);
+        printf("%s", ": ");
+        modl_object_display(&self->fields->values[i]);
+        printf("%s", ", ");
+    }
     for (uint32_t i = 0; i < self->capacity; ++i)
     {
-        // printf("  bucket #%d [ ", i);
-        struct ModlMapBucket * bkt = &self->vec[i];
-        while (bkt && bkt->next)
-        {
-            // printf("(%lx)", (size_t)bkt);
-            modl_object_display(&bkt->key);
-            printf("%s", ": ");
-            modl_object_display(&bkt->obj);
-            printf("%s", ", ");
+        if (self->ctrl[i] < 0) continue;
 
-            bkt = bkt->next;
-        }
-        // printf("%c\n", ']');
+        modl_object_display(&self->vec[i].key);
+        printf("%s", ": ");
+        modl_object_display(&self->vec[i].obj);
+        printf("%s", ", ");
+    }
+    struct ModlMapResize const * const resize = self->resize;
+    for (uint32_t i = NULL != resize ? resize->migrated : 0; NULL != resize && i < resize->capacity; ++i)
+    {
+        if (resize->ctrl[i] < 0) continue;
+
+        modl_object_display(&resize->vec[i].key);
+        printf("%s", ": ");
+        modl_object_display(&resize->vec[i].obj);
+        printf("%s", ", ");
     }
     printf("%c", ']');
 }
 
 void modl_map_set(struct ModlMap * self, struct ModlObject key, struct ModlObject val)
-{   
-    unsigned int hash = modl_object_hash(key);
-    // printf("adding key ");
-    // modl_object_display(&key);
-    // printf(" with hash=%u and index=%u\n", hash, hash % self->capacity);
-    hash %= self->capacity;
+{
+    if (modl_map_is_array_index(key, self->array_size + 1))
+    {
+        if (modl_to_int(key) == self->array_size)
+        {
+            modl_map_array_append(self, val);
+            return;
+        }
+
+        struct ModlObject * const entry = &self->array[modl_to_int(key)];
+        if (modl_object_is_unbound(*entry))
+        {
+            self->array_holes -= 1;
+            self->size += 1;
+        }
+
+        modl_object_take(val);
+        modl_object_release(*entry);
+        *entry = val;
+        return;
+    }
+
+    modl_map_hash_set(self, key, val);
+}
+
+/*!
+ *  \brief Keep the string keys of the map in shapes
+ *  \param self Map, left as it is if its hash part is in use
+ */
+void modl_map_use_shapes(struct ModlMap * self)
+{
+    if (NULL != self->fields || 0 != self->capacity)
+        return;
+
+    self->fields = &modl_map_root_fields;
+    modl_shape_take(&modl_shape_root);
+}
+
+/*!
+ *  \brief Set entries in bulk, reserving room for all of them first
+ *  \param self Map
+ *  \param keys Keys of the entries, NULL to append the values to the array
+ *         part
+ *  \param vals Values of the entries
+ *  \param count Number of entries
+ */
+void modl_map_set_all(struct ModlMap * self, struct ModlObject const * keys, struct ModlObject const * vals, size_t count)
+{
+    if (NULL == keys)
+    {
+        modl_map_reserve(self, count, 0);
+        for (size_t i = 0; i < count; ++i)
+            modl_map_array_append(self, vals[i]);
+        return;
+    }
+
+    /* keys that may continue the array part do not need hash slots */
+    size_t array_count = 0;
+    for (size_t i = 0; i < count; ++i)
+        array_count += modl_map_is_array_index(keys[i], self->array_size + count) && modl_to_int(keys[i]) >= self->array_size;
+    modl_map_reserve(self, array_count, count - array_count);
 
-    // modl_map_print(self);
-    // printf("%c", '\n');
+    for (size_t i = 0; i < count; ++i)
+        modl_map_set(self, keys[i], vals[i]);
+}
+
+/*!
+ *  \brief Append value with the key following the array part
+ *  \param self Map
+ *  \param val Value
+ */
+void modl_map_push(struct ModlMap * self, struct ModlObject val)
+{
+    modl_map_array_append(self, val);
+}
 
-    struct ModlMapBucket *bkt_iter;
-    bkt_iter = &self->vec[hash];
+/* give memory of the array part back once it is a quarter full */
+static void modl_map_array_shrink(struct ModlMap * self)
+{
+    if (self->array_size >= self->array_capacity / MODL_MAP_SHRINK_RATIO)
+        return;
 
-    while (bkt_iter->next)
+    if (0 == self->array_size)
     {
-        if (modl_object_equals(key, bkt_iter->key))
+        free(self->array);
+        self->array = NULL;
+        self->array_capacity = 0;
+        return;
+    }
+
+    self->array_capacity = 2 * self->array_size;
+    self->array = realloc(self->array, self->array_capacity * sizeof (struct ModlObject));
+}
+
+static inline bool modl_map_array_is_sparse(struct ModlMap const * self)
+{
+    return self->array_size - self->array_holes < self->array_size / MODL_MAP_SHRINK_RATIO;
+}
+
+/* move the entries of an array part with few keys left to the hash part */
+static void modl_map_array_demote(struct ModlMap * self)
+{
+    struct ModlObject * const array = self->array;
+    uint32_t const count = self->array_size;
+
+    uint32_t const bound = count - self->array_holes;
+
+    self->size -= bound;
+    self->array = NULL;
+    self->array_size = 0;
+    self->array_capacity = 0;
+    self->array_holes = 0;
+    modl_map_reserve(self, 0, bound);
+
+    /* keys from 0 on that are still bound make up the new array part */
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (modl_object_is_unbound(array[i])) continue;
+
+        modl_map_set(self, int_to_modl(i), array[i]);
+        modl_object_release(array[i]);
+    }
+
+    free(array);
+}
+
+/* release the slots of an empty hash part */
+static void modl_map_hash_release(struct ModlMap * self)
+{
+    free(self->ctrl);
+    free(self->vec);
+    self->ctrl = NULL;
+    self->vec = NULL;
+    self->capacity = 0;
+    self->tombstones = 0;
+    self->shrink_pending = FALSE;
+}
+
+/*!
+ *  \brief Remove entry from map
+ *  \param self Map
+ *  \param key Key of the entry
+ *  \return TRUE if the entry existed
+ */
+bool modl_map_remove(struct ModlMap * self, struct ModlObject key)
+{
+    if (modl_map_is_array_index(key, self->array_size))
+    {
+        uint32_t const index = (uint32_t) modl_to_int(key);
+        struct ModlObject const removed = self->array[index];
+        if (modl_object_is_unbound(removed))
+            return FALSE;
+
+        /* the key leaves an unbound hole, the other keys keep their place */
+        self->array[index] = modl_unbound();
+        self->array_holes += 1;
+        self->size -= 1;
+
+        /* the array part ends with its last bound key */
+        while (0 != self->array_size && modl_object_is_unbound(self->array[self->array_size - 1]))
         {
-            // and
-            modl_object_take(val);
-            modl_object_release(bkt_iter->obj);
-            bkt_iter->obj = val;
-            return;
+            self->array_size -= 1;
+            self->array_holes -= 1;
         }
 
-        bkt_iter = bkt_iter->next;
+        modl_object_release(removed);
+        modl_map_array_shrink(self);
+        if (modl_map_array_is_sparse(self))
+        {
+            if (self->iterating) self->shrink_pending = TRUE;
+            else modl_map_array_demote(self);
+        }
+        return TRUE;
     }
 
-    if (self->size > 2*self->capacity/3)
+    if (NULL != self->fields)
     {
-        modl_map_resize(self);
-        hash = modl_object_hash(key);
-        // printf("adding key ");
-        // modl_object_display(&key);
-        // printf(" with hash=%u and index=%u\n", hash, hash % self->capacity);
-        bkt_iter = &self->vec[hash % self->capacity];
-        while (bkt_iter->next) bkt_iter = bkt_iter->next;
+        uint32_t const slot = modl_shape_find(self->fields->shape, key);
+        if (SLOT_NOT_FOUND == slot || NULL == modl_map_field(self, slot))
+            return FALSE;
+
+        /* the key stays in the shape, the other fields keep their slots */
+        modl_object_release(self->fields->values[slot]);
+        self->fields->values[slot] = modl_unbound();
+        self->size -= 1;
+        self->fields->size -= 1;
+        return TRUE;
     }
 
-    self->size += 1;
-    *bkt_iter = (struct ModlMapBucket) {
-        .key = modl_object_take(key),
-        .obj = modl_object_take(val),
-        .next = calloc(1, sizeof (struct ModlMapBucket))
-    };
+    struct ModlObject removed;
+    if (not modl_map_hash_extract(self, key, &removed))
+        return FALSE;
+
+    modl_object_release(removed);
+
+    /* entries stay in their slots while the map is iterated */
+    if (0 == modl_map_hash_size(self) && NULL == self->resize)
+        modl_map_hash_release(self);
+    else if (self->iterating)
+        self->shrink_pending = TRUE;
+    else
+        modl_map_hash_shrink(self);
+
+    return TRUE;
+}
+
+/*!
+ *  \brief Finish a resize in progress
+ *  \param self Map
+ */
+void modl_map_finish_resize(struct ModlMap * self)
+{
+    if (NULL != self->resize)
+        modl_map_migrate(self, UINT32_MAX);
+}
+
+/* entry at or after the cursor */
+static bool modl_map_next_entry(struct ModlMap const * self, uint64_t * cursor, struct ModlObject * key, struct ModlObject * val)
+{
+    uint64_t position = *cursor;
+
+    for (; position < self->array_size; ++position)
+    {
+        if (modl_object_is_unbound(self->array[position])) continue;
+
+        *key = int_to_modl(position);
+        *val = self->array[position];
+        *cursor = position + 1;
+        return TRUE;
+    }
+
+    uint64_t const hash_start = (uint64_t) 1 << 32;
+    uint64_t const old_start = hash_start + self->capacity;
+    if (position < hash_start)
+        position = hash_start;
+
+    for (; NULL != self->fields && position < hash_start + self->fields->shape->count; ++position)
+    {
+        struct ModlObject const * field = modl_map_field(self, position - hash_start);
+        if (NULL == field) continue;
+
+        *key = self->fields->shape->keys[position - hash_start];
+        *val = *field;
+        *cursor = position + 1;
+        return TRUE;
+    }
+
+    for (; position < old_start; ++position)
+    {
+        struct ModlMapBucket const * bucket = &self->vec[position - hash_start];
+        if (self->ctrl[position - hash_start] < 0) continue;
+
+        *key = bucket->key;
+        *val = bucket->obj;
+        *cursor = position + 1;
+        return TRUE;
+    }
+
+    /* entries not moved by a resize started during iteration */
+    struct ModlMapResize const * const resize = self->resize;
+    if (NULL == resize)
+    {
+        *cursor = position;
+        return FALSE;
+    }
+
+    if (position - old_start < resize->migrated)
+        position = old_start + resize->migrated;
+
+    for (; position < old_start + resize->capacity; ++position)
+    {
+        if (resize->ctrl[position - old_start] < 0) continue;
+
+        *key = resize->vec[position - old_start].key;
+        *val = resize->vec[position - old_start].obj;
+        *cursor = position + 1;
+        return TRUE;
+    }
+
+    *cursor = position;
+    return FALSE;
+}
+
+/*!
+ *  \brief Advance iteration over the map
+ *
+ *  The cursor is a position in the array part below 2^32 and a slot of
+ *  the fields or of the hash part above it. From the first entry returned
+ *  until FALSE is returned the map is being iterated: removals leave all
+ *  other entries in place and the map shrinks once the iteration ends, so
+ *  removals and value changes do not disturb the cursor. Adding keys may
+ *  rehash the hash part; the iteration then goes on from the same slot
+ *  and may skip or repeat entries. An iteration left early defers
+ *  shrinking to the next insert or the end of a later iteration.
+ *  \param self Map
+ *  \param cursor Position, 0 to start, set past the returned entry
+ *  \param key Borrowed key of the entry
+ *  \param val Borrowed value of the entry
+ *  \return FALSE if there are no more entries
+ */
+bool modl_map_next(struct ModlMap * self, uint64_t * cursor, struct ModlObject * key, struct ModlObject * val)
+{
+    if (modl_map_next_entry(self, cursor, key, val))
+    {
+        self->iterating = TRUE;
+        return TRUE;
+    }
+
+    self->iterating = FALSE;
+    if (self->shrink_pending)
+    {
+        if (modl_map_array_is_sparse(self))
+            modl_map_array_demote(self);
+        modl_map_hash_shrink(self);
+    }
+    return FALSE;
 }
@@ -3,27 +3,142 @@
 #include <string.h>
 #include <inttypes.h>
 
+#include "defs.h"
 
+
+/*
+ *  Open addressing hash map with one metadata byte per slot. Metadata is
+ *  scanned a group of MODL_MAP_GROUP_WIDTH slots at a time (with SSE2 when
+ *  available): a full slot stores 7 bits of the key hash, so most probes
+ *  compare keys only on a likely match. Capacity is zero or a power of two
+ *  not smaller than the group width; the first group of metadata is
+ *  mirrored after the last one so a group can be loaded at any slot.
+ *
+ *  Integer keys 0 .. array_size-1 are kept in a separate array part
+ *  instead; the hash part never holds the key array_size, so appending
+ *  and the length of the sequence are O(1). size counts both parts.
+ *  Removing a key of the array part leaves an unbound hole, so the keys
+ *  after it keep their place; the last key of the array part is always
+ *  bound.
+ *
+ *  An incremental map does not rehash all entries when the hash part
+ *  grows: the previous slots are kept and every get, set and remove moves
+ *  MODL_MAP_MIGRATION_STEP of them to the new ones until none are left.
+ *
+ *  While all keys of the hash part are integers or all are strings the
+ *  map probes with a comparison specialized for that type, and lookups
+ *  of keys of another type miss without probing. The first key of a
+ *  different type switches the map to generic comparison until the hash
+ *  part is empty again.
+ *
+ *  Either part shrinks on removal once less than 1 / MODL_MAP_SHRINK_RATIO
+ *  of it is in use; an array part that is mostly holes moves its keys to
+ *  the hash part. While the map is iterated removal moves no entries, and
+ *  shrinking waits for the end of the iteration or the next insert.
+ */
+#define MODL_MAP_GROUP_WIDTH 16
+#define MODL_MAP_MIGRATION_STEP (2 * MODL_MAP_GROUP_WIDTH)
+#define MODL_MAP_SHRINK_RATIO 4
+
+
+/*
+ *  A map that uses shapes keeps its string keys in a shape instead of the
+ *  hash part while it has no other keys besides the array part. A shape
+ *  is the sequence of keys added to a map; maps that add the same keys in
+ *  the same order share it, and the values live in a flat array of
+ *  fields indexed by the position of the key in the shape. Shapes form a
+ *  tree from an empty root, each one referenced by its children and by
+ *  the maps using it.
+ *
+ *  Removing a key leaves its field unbound, so the shape stays. A key of
+ *  another type, or a key beyond MODL_SHAPE_MAX_FIELDS, moves the fields
+ *  to the hash part for good.
+ */
+#define MODL_SHAPE_MAX_FIELDS 32
+
+enum __attribute__ ((__packed__))
+ModlMapKeys
+{
+    ModlMapKeysNone    = 0,
+    ModlMapKeysInteger = 1,
+    ModlMapKeysString  = 2,
+    ModlMapKeysGeneric = 3,
+};
+
+struct ModlShape;
 struct ModlMapBucket;
+struct ModlMapResize;
+struct ModlMapFields;
 struct ModlMap {
     uint32_t capacity;
     uint32_t size;
+    uint32_t tombstones;
+    enum ModlMapKeys keys;
+    bool shrink_pending;
+    bool incremental;
+    /* an iteration has returned entries and not ended yet */
+    bool iterating;
+    int8_t * ctrl;
     struct ModlMapBucket * vec;
+
+    struct ModlObject * array;
+    uint32_t array_size;
+    uint32_t array_capacity;
+    /* removed keys below array_size */
+    uint32_t array_holes;
+
+    /* hash part being moved out of, NULL when no resize is in progress */
+    struct ModlMapResize * resize;
+    /* string keys while the map uses a shape, NULL otherwise */
+    struct ModlMapFields * fields;
 };
 
+/* whether maps initialized from now on resize incrementally */
+extern bool modl_map_incremental_resize;
+
 #include "object.h"
 
+struct ModlShape {
+    struct ModlShape * parent;
+    struct ModlShape * children;
+    struct ModlShape * sibling;
+    int32_t refs;
+    uint32_t count;
+    /* keys in field order, the last one is added to the parent's */
+    struct ModlObject keys[];
+};
+
 struct ModlMapBucket {
     struct ModlObject obj;
     struct ModlObject key;
+};
 
-    struct ModlMapBucket * next;
+struct ModlMapResize {
+    int8_t * ctrl;
+    struct ModlMapBucket * vec;
+    uint32_t capacity;
+    uint32_t size;
+    /* slots below this one are moved */
+    uint32_t migrated;
+};
+
+struct ModlMapFields {
+    struct ModlShape * shape;
+    /* bound fields */
+    uint32_t size;
+    uint32_t capacity;
+    struct ModlObject values[];
 };
 
 
 void modl_map_print(struct ModlMap * self);
 
 void modl_map_dispose(struct ModlMap * self);
+/* release up to count entries of a map being disposed, the cursor starts
+   at 0; FALSE once the map is disposed */
+bool modl_map_dispose_step(struct ModlMap * self, uint64_t * cursor, uint32_t count);
+/* call visit with every key and value the map holds a reference to */
+void modl_map_visit(struct ModlMap * self, void (* visit)(struct ModlObject * obj, void * context), void * context);
 
 struct ModlMap *modl_map_resize(struct ModlMap *self);
 
@@ -32,3 +147,40 @@ struct ModlMap *modl_map_init(struct ModlMap * self, size_t initial_size);
 struct ModlObject* modl_map_get(struct ModlMap * self, struct ModlObject key);
 
 void modl_map_set(struct ModlMap *self, struct ModlObject key, struct ModlObject val);
+
+bool modl_map_remove(struct ModlMap * self, struct ModlObject key);
+
+void modl_map_push(struct ModlMap * self, struct ModlObject val);
+
+void modl_map_reserve(struct ModlMap * self, size_t array_count, size_t hash_count);
+
+void modl_map_finish_resize(struct ModlMap * self);
+
+bool modl_map_next(struct ModlMap * self, uint64_t * cursor, struct ModlObject * key, struct ModlObject * val);
+
+void modl_map_set_all(struct ModlMap * self, struct ModlObject const * keys, struct ModlObject const * vals, size_t count);
+
+void modl_map_use_shapes(struct ModlMap * self);
+
+void modl_map_set_field(struct ModlMap * self, uint32_t slot, struct ModlObject val);
+
+void modl_map_add_field(struct ModlMap * self, struct ModlShape * target, struct ModlObject val);
+
+uint32_t modl_shape_find(struct ModlShape const * self, struct ModlObject key);
+
+void modl_shape_take(struct ModlShape * self);
+
+void modl_shape_release(struct ModlShape * self);
+
+/* shape of the map, NULL if it does not use shapes */
+static inline struct ModlShape * modl_map_shape(struct ModlMap const * self)
+{
+    return NULL != self->fields ? self->fields->shape : NULL;
+}
+
+/* field of the map's shape, NULL if its key was removed */
+static inline struct ModlObject * modl_map_field(struct ModlMap const * self, uint32_t slot)
+{
+    struct ModlObject * field = &self->fields->values[slot];
+    return modl_object_is_unbound(*field) ? NULL : field;
+}
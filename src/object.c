@@ -2,55 +2,113 @@
 #include <string.h>
 
 #include "object.h"
+#include "pool.h"
+#include "collector.h"
 
 
-struct ModlObject modl_object_make_ref()
+struct ModlObject modl_object_make_ref(enum ModlType type)
 {
-  struct ModlObject object = { .value = { .ref = malloc(sizeof (struct ModlObjectReference)) } };
-  object.value.ref->count = 0;
-  object.value.ref->has_hash = 0;
+  struct ModlObject object = ref_to_modl(type, modl_pool_alloc_ref());
+  modl_to_ref(object)->count = 0;
+  modl_to_ref(object)->has_hash = 0;
+  modl_to_ref(object)->color = ModlColorBlack;
+  modl_to_ref(object)->buffered = FALSE;
   return object;
 }
 
+/*!
+ *  \brief Integer too large for a NaN-boxed object
+ *  \param data Value
+ *  \return Temporary reference holding the value
+ */
+struct ModlObject modl_object_box_int(int64_t data)
+{
+#ifdef MODL_NAN_BOXING
+  struct ModlObject object = modl_object_make_ref((enum ModlType) MODL_NAN_TAG_BOXED);
+  modl_to_ref(object)->value.integer = data;
+  return object;
+#else
+  return int_to_modl(data);
+#endif
+}
+
 struct ModlObject modl_table()
 {
-  struct ModlObject object = modl_object_make_ref();
-  object.type = ModlTypeTable;
-  modl_map_init(&object.value.ref->value.table, 8);
+  struct ModlObject object = modl_object_make_ref(ModlTypeTable);
+  modl_map_init(&modl_to_ref(object)->value.table, 0);
+  modl_map_use_shapes(&modl_to_ref(object)->value.table);
+  return object;
+}
+
+/*!
+ *  \brief Table with room for entries, so filling it does not reallocate
+ *  \param array_count Number of values with keys 0, 1, ...
+ *  \param hash_count Number of other entries
+ */
+struct ModlObject modl_table_with_capacity(size_t array_count, size_t hash_count)
+{
+  struct ModlObject object = modl_object_make_ref(ModlTypeTable);
+  modl_map_init(&modl_to_ref(object)->value.table, hash_count);
+  modl_map_use_shapes(&modl_to_ref(object)->value.table);
+  modl_map_reserve(&modl_to_ref(object)->value.table, array_count, 0);
   return object;
 }
 
 struct ModlObject modl_table_new()
 {
   struct ModlObject object = modl_table();
-  object.value.ref->count = 1;
+  modl_to_ref(object)->count = 1;
   return object;
 }
 
 
+struct ModlObject transfer_str_to_modl_n(char * data, size_t length)
+{
+  struct ModlObject object = modl_object_make_ref(ModlTypeString);
+  modl_to_ref(object)->value.string = data;
+  modl_to_ref(object)->string_size = 0;
+  modl_to_ref(object)->string_length = (uint32_t) length;
+  modl_to_ref(object)->hash = modl_string_hash(data, length);
+  modl_to_ref(object)->has_hash = TRUE;
+  return object;
+}
+
 struct ModlObject transfer_str_to_modl(char * data)
 {
-  struct ModlObject object = modl_object_make_ref();
-  object.type = ModlTypeString;
-  object.value.ref->value.string = data;
-  modl_object_hash(object);
+  return transfer_str_to_modl_n(data, strlen(data));
+}
+
+struct ModlObject str_to_modl_n(char const * data, size_t length)
+{
+  char * copy = modl_pool_alloc_string((length + 1) * sizeof(char));
+  memcpy(copy, data, length);
+  copy[length] = '\0';
+  struct ModlObject object = transfer_str_to_modl_n(copy, length);
+  modl_to_ref(object)->string_size = length + 1;
   return object;
 }
 
-struct ModlObject str_to_modl(char const * data)
+struct ModlObject str_concat_to_modl(char const * a, size_t length_a, char const * b, size_t length_b)
 {
-  struct ModlObject object = modl_object_make_ref();
-  object.type = ModlTypeString;
-  object.value.ref->value.string = strcpy(malloc((strlen(data) + 1) * sizeof(char)), data);
-  modl_object_hash(object);
+  size_t const length = length_a + length_b;
+  char * copy = modl_pool_alloc_string((length + 1) * sizeof(char));
+  memcpy(copy, a, length_a);
+  memcpy(copy + length_a, b, length_b);
+  copy[length] = '\0';
+  struct ModlObject object = transfer_str_to_modl_n(copy, length);
+  modl_to_ref(object)->string_size = length + 1;
   return object;
 }
 
+struct ModlObject str_to_modl(char const * data)
+{
+  return str_to_modl_n(data, strlen(data));
+}
+
 struct ModlObject ifun_to_modl(struct Environment * environment, uint64_t position)
 {
-  struct ModlObject object = modl_object_make_ref();
-  object.type = ModlTypeFunction;
-  object.value.ref->value.fun = (struct ModlTypeFunctionInfo) {
+  struct ModlObject object = modl_object_make_ref(ModlTypeFunction);
+  modl_to_ref(object)->value.fun = (struct ModlTypeFunctionInfo) {
     .is_external = FALSE,
     .position = position,
     .context = environment,
@@ -60,9 +118,8 @@ struct ModlObject ifun_to_modl(struct Environment * environment, uint64_t positi
 
 struct ModlObject efun_to_modl(uint64_t pointer)
 {
-  struct ModlObject object = modl_object_make_ref();
-  object.type = ModlTypeFunction;
-  object.value.ref->value.fun = (struct ModlTypeFunctionInfo) {
+  struct ModlObject object = modl_object_make_ref(ModlTypeFunction);
+  modl_to_ref(object)->value.fun = (struct ModlTypeFunctionInfo) {
     .is_external = TRUE,
     .position = pointer,
     .context = NULL,
@@ -73,8 +130,8 @@ struct ModlObject efun_to_modl(uint64_t pointer)
 
 char const * modl_to_str(struct ModlObject object)
 {
-  if (ModlTypeString != object.type) return NULL;
-  return object.value.ref->value.string;
+  if (ModlTypeString != modl_object_type(object)) return NULL;
+  return modl_to_ref(object)->value.string;
 }
 
 
@@ -82,21 +139,21 @@ bool modl_object_is_tmp(struct ModlObject const * self)
 {
   if (NULL == self) return TRUE;
   if (modl_object_is_value_type(*self)) return TRUE;
-  return self->value.ref->count == 0;
+  return modl_to_ref(*self)->count == 0;
 }
 
 bool modl_object_is_single(struct ModlObject const * self)
 {
   if (NULL == self) return FALSE;
   if (modl_object_is_value_type(*self)) return TRUE;
-  return self->value.ref->count == 1;
+  return modl_to_ref(*self)->count == 1;
 }
 
 
 struct ModlObject modl_object_take(struct ModlObject self)
 {
   if (modl_object_is_value_type(self)) return self;
-  self.value.ref->count += 1;
+  modl_to_ref(self)->count += 1;
   return self;
 }
 
@@ -104,7 +161,7 @@ struct ModlObject modl_object_disown(struct ModlObject self)
 {
   if (modl_object_is_value_type(self)) return self;
 
-  self.value.ref->count -= 1;
+  modl_to_ref(self)->count -= 1;
   // if (self.value.ref->count < 0)
   // {
   //   printf("\x1b[31;1m  %s  --> %d\x1b[0m\n", "Liek watafak? instances count is negative?!?!", self.value.ref->count);
@@ -114,25 +171,136 @@ struct ModlObject modl_object_disown(struct ModlObject self)
   return self;
 }
 
+/* tables whose last reference was dropped while the queue is enabled,
+   each with the position of its dispose */
+struct ModlReleaseEntry
+{
+  struct ModlObjectReference * ref;
+  uint64_t cursor;
+};
+
+static struct ModlReleaseEntry * modl_object_release_queue = NULL;
+static size_t modl_object_release_count = 0, modl_object_release_capacity = 0;
+static struct ModlReleaseStats modl_object_release_stats = { 0 };
+/* a table is being disposed, tables it releases are queued so that
+   nested tables cannot make a dispose unbounded */
+static bool modl_object_release_nested = FALSE;
+
+static void modl_object_release_enqueue(struct ModlObjectReference * ref)
+{
+  if (modl_object_release_count == modl_object_release_capacity)
+  {
+    modl_object_release_capacity *= 2;
+    modl_object_release_queue = realloc(modl_object_release_queue, modl_object_release_capacity * sizeof (struct ModlReleaseEntry));
+  }
+
+  modl_object_release_queue[modl_object_release_count++] = (struct ModlReleaseEntry) { .ref = ref, .cursor = 0 };
+  modl_object_release_stats.queued += 1;
+  if (modl_object_release_count > modl_object_release_stats.max_pending)
+    modl_object_release_stats.max_pending = modl_object_release_count;
+}
+
+/*!
+ *  \brief Defer disposing of dead tables to modl_object_release_pending
+ *  \param capacity Initial size of the queue
+ */
+void modl_object_release_queue_init(size_t capacity)
+{
+  modl_object_release_capacity = capacity > 0 ? capacity : 1;
+  modl_object_release_queue = malloc(modl_object_release_capacity * sizeof (struct ModlReleaseEntry));
+}
+
+/*!
+ *  \brief Dispose of queued tables
+ *
+ *  Tables are disposed a few entries at a time, newest first, so the
+ *  work of a step stays within budget even for a single big table.
+ *  Tables freed meanwhile are queued on top.
+ *
+ *  \param budget Entries to release, SIZE_MAX to drain the queue
+ *  \return Number of tables still queued
+ */
+size_t modl_object_release_pending(size_t budget)
+{
+  while (modl_object_release_count > 0 && budget > 0)
+  {
+    size_t const top = modl_object_release_count - 1;
+    struct ModlObjectReference * ref = modl_object_release_queue[top].ref;
+    uint64_t cursor = modl_object_release_queue[top].cursor;
+    uint32_t const step = budget < MODL_RELEASE_STEP ? (uint32_t) budget : MODL_RELEASE_STEP;
+
+    /* releasing entries may queue more tables and move the queue */
+    modl_object_release_nested = TRUE;
+    bool const more = modl_map_dispose_step(&ref->value.table, &cursor, step);
+    modl_object_release_nested = FALSE;
+    uint64_t const done = cursor - modl_object_release_queue[top].cursor;
+    modl_object_release_queue[top].cursor = cursor;
+    budget -= done;
+    modl_object_release_stats.released += done;
+
+    if (not more)
+    {
+      /* tables queued by the last step are above it, the newest one
+         takes its place */
+      modl_object_release_queue[top] = modl_object_release_queue[--modl_object_release_count];
+      modl_collector_free_ref(ref);
+    }
+  }
+
+  return modl_object_release_count;
+}
+
+/*!
+ *  \brief Drain the queue and go back to disposing of tables at once
+ */
+void modl_object_release_queue_free(void)
+{
+  modl_object_release_pending(SIZE_MAX);
+  free(modl_object_release_queue);
+  modl_object_release_queue = NULL;
+  modl_object_release_capacity = 0;
+}
+
+void modl_object_release_queue_stats(struct ModlReleaseStats * stats)
+{
+  *stats = modl_object_release_stats;
+}
+
 bool modl_object_release(struct ModlObject self)
 {
   if (modl_object_is_value_type(self)) return TRUE;
 
   modl_object_disown(self);
 
-  if (self.value.ref->count == 0)
+  if (modl_to_ref(self)->count == 0)
   {
     // printf("  %s: ", "destroying object");
     // modl_object_display(self);
     // printf("%c", '\n');
 
-    switch (self.type)
+    switch (modl_object_type(self))
     {
-      case ModlTypeString: free(self.value.ref->value.string); break;
+      case ModlTypeString:
+      {
+        if (0 == modl_to_ref(self)->string_size) free(modl_to_ref(self)->value.string);
+        else modl_pool_free_string(modl_to_ref(self)->value.string, modl_to_ref(self)->string_size);
+      } break;
 
       case ModlTypeTable:
       {
-        modl_map_dispose(&self.value.ref->value.table);
+        struct ModlMap * table = &modl_to_ref(self)->value.table;
+        if (NULL != modl_object_release_queue
+          && (modl_object_release_nested
+              || table->capacity + (NULL != table->resize ? table->resize->capacity : 0) + table->size > MODL_RELEASE_INLINE_COST))
+        {
+          modl_object_release_enqueue(modl_to_ref(self));
+          return TRUE;
+        }
+
+        bool const nested = modl_object_release_nested;
+        modl_object_release_nested = TRUE;
+        modl_map_dispose(table);
+        modl_object_release_nested = nested;
       //   {
       //     struct ModlTableNode * node = self->value.table.integer_nodes;
       //     while (NULL != node->key)
@@ -166,10 +334,14 @@ bool modl_object_release(struct ModlObject self)
       default: break;
     }
 
-    free(self.value.ref);
+    modl_collector_free_ref(modl_to_ref(self));
     return TRUE;
   }
 
+  /* the last references may now be those of a cycle */
+  if (ModlTypeTable == modl_object_type(self) && modl_collector_is_enabled())
+    modl_collector_possible_root(modl_to_ref(self));
+
   return FALSE;
 }
 
@@ -177,55 +349,140 @@ bool modl_object_release_tmp(struct ModlObject self)
 {
   if (modl_object_is_value_type(self)) return TRUE;
 
-  self.value.ref->count += 1;
+  modl_to_ref(self)->count += 1;
   return modl_object_release(self);
 }
 
 int32_t modl_object_get_reference_count(struct ModlObject self)
 {
   if (modl_object_is_value_type(self)) return 1;
-  return self.value.ref->count;
+  return modl_to_ref(self)->count;
+}
+
+/* moves a single object, the reference to it is replaced by the result */
+static struct ModlObject modl_object_move(struct ModlObject self)
+{
+  if (modl_object_is_value_type(self) || 1 < modl_to_ref(self)->count) return self;
+  /* the collector buffer refers to the old address */
+  if (modl_to_ref(self)->buffered) return self;
+  if (not modl_pool_in_region(modl_to_ref(self))) return self;
+
+  struct ModlObjectReference * old = modl_to_ref(self);
+  struct ModlObject object = ModlTypeInteger == modl_object_type(self)
+    ? modl_object_box_int(modl_to_int(self))
+    : modl_object_make_ref(modl_object_type(self));
+  *modl_to_ref(object) = *old;
+
+  if (ModlTypeString == modl_object_type(self) && 0 != old->string_size)
+  {
+    modl_to_ref(object)->value.string = modl_pool_alloc_string(old->string_size);
+    memcpy(modl_to_ref(object)->value.string, old->value.string, old->string_size);
+    modl_pool_free_string(old->value.string, old->string_size);
+  }
+
+  modl_pool_free_ref(old);
+  return object;
+}
+
+/* tables moved out of their regions whose entries are not visited yet */
+struct ModlPromotion
+{
+  struct ModlObjectReference ** tables;
+  size_t count, capacity;
+};
+
+static void modl_object_promote_entry(struct ModlObject * obj, void * context)
+{
+  struct ModlPromotion * promotion = (struct ModlPromotion *) context;
+  struct ModlObject const moved = modl_object_move(*obj);
+  if (modl_object_is_value_type(moved) || modl_to_ref(moved) == modl_to_ref(*obj)) return;
+
+  *obj = moved;
+  if (ModlTypeTable != modl_object_type(moved)) return;
+
+  if (promotion->count + 1 > promotion->capacity)
+  {
+    promotion->capacity = promotion->capacity ? 2 * promotion->capacity : 16;
+    promotion->tables = realloc(promotion->tables, promotion->capacity * sizeof (struct ModlObjectReference *));
+  }
+  promotion->tables[promotion->count++] = modl_to_ref(moved);
+}
+
+/*!
+ *  \brief Move object out of its region, see pool.h
+ *
+ *  Only objects with a single reference are moved, as the other
+ *  references could not be updated; others keep their region alive.
+ *  Entries of a moved table that only it refers to are moved along,
+ *  nested tables included.
+ *
+ *  \param self Object, its only reference is replaced by the result
+ *  \return Object allocated outside of regions or self
+ */
+struct ModlObject modl_object_promote(struct ModlObject self)
+{
+  /* regions may still be open, as when a value is stored in an outer table */
+  struct ModlRegion * const open = modl_pool_region_suspend();
+  struct ModlObject const object = modl_object_move(self);
+
+  if (not modl_object_is_value_type(object) && modl_to_ref(object) != modl_to_ref(self)
+      && ModlTypeTable == modl_object_type(object))
+  {
+    /* a worklist, as tables may nest deeper than the native stack allows */
+    struct ModlPromotion promotion = { NULL, 0, 0 };
+    modl_map_visit(&modl_to_ref(object)->value.table, modl_object_promote_entry, &promotion);
+    while (0 != promotion.count)
+    {
+      struct ModlObjectReference * const table = promotion.tables[--promotion.count];
+      modl_map_visit(&table->value.table, modl_object_promote_entry, &promotion);
+    }
+    free(promotion.tables);
+  }
+
+  modl_pool_region_resume(open);
+  return object;
 }
 
 
 bool modl_object_equals(struct ModlObject self, struct ModlObject other)
 {
   // if (self == other) return TRUE;
-  if (self.type != other.type) return FALSE;
+  if (modl_object_type(self) != modl_object_type(other)) return FALSE;
 
-  if (modl_object_is_value_type(self))
+  /* boxed integers compare by value too */
+  if (modl_object_is_value_type(self) || ModlTypeInteger == modl_object_type(self))
   {
-    switch (self.type)
+    switch (modl_object_type(self))
     {
       case ModlTypeNil: return TRUE;
-      case ModlTypeBoolean: return self.value.boolean == other.value.boolean;
-      case ModlTypeInteger: return self.value.integer == other.value.integer;
-      case ModlTypeFloating: return self.value.floating == other.value.floating;
+      case ModlTypeBoolean: return modl_to_bool(self) == modl_to_bool(other);
+      case ModlTypeInteger: return modl_to_int(self) == modl_to_int(other);
+      case ModlTypeFloating: return modl_to_double(self) == modl_to_double(other);
       default: return TRUE;
     }
   }
   else
   {
-    if (self.value.ref == other.value.ref)
+    if (modl_to_ref(self) == modl_to_ref(other))
       return TRUE;
       
-    if (self.value.ref->has_hash && other.value.ref->has_hash && self.value.ref->hash != other.value.ref->hash)
+    if (modl_to_ref(self)->has_hash && modl_to_ref(other)->has_hash && modl_to_ref(self)->hash != modl_to_ref(other)->hash)
     {
       return FALSE;
     }
 
-    switch (self.type)
+    switch (modl_object_type(self))
     {
       case ModlTypeString:
-        return self.value.ref->value.string == other.value.ref->value.string
-            || 0 == strcmp(self.value.ref->value.string, other.value.ref->value.string);
+        return modl_to_ref(self)->value.string == modl_to_ref(other)->value.string
+            || 0 == strcmp(modl_to_ref(self)->value.string, modl_to_ref(other)->value.string);
 
       case ModlTypeTable: return FALSE;
 
       case ModlTypeFunction:
-        return self.value.ref->value.fun.is_external == other.value.ref->value.fun.is_external
-            && self.value.ref->value.fun.position    == other.value.ref->value.fun.position
-            && self.value.ref->value.fun.context     == other.value.ref->value.fun.context;
+        return modl_to_ref(self)->value.fun.is_external == modl_to_ref(other)->value.fun.is_external
+            && modl_to_ref(self)->value.fun.position    == modl_to_ref(other)->value.fun.position
+            && modl_to_ref(self)->value.fun.context     == modl_to_ref(other)->value.fun.context;
 
       default: return FALSE;
     }
@@ -236,28 +493,28 @@ int modl_object_cmp(struct ModlObject self, struct ModlObject other)
 {
   // if (NULL == self || NULL == other) return -1;
   // if (self == other) return 0;
-  if (self.type != other.type) return -1;
+  if (modl_object_type(self) != modl_object_type(other)) return -1;
 
-  switch (self.type)
+  switch (modl_object_type(self))
   {
     case ModlTypeNil: return 0;
-    case ModlTypeBoolean: return self.value.boolean - other.value.boolean;
+    case ModlTypeBoolean: return modl_to_bool(self) - modl_to_bool(other);
     case ModlTypeInteger:
-      return self.value.integer > other.value.integer
+      return modl_to_int(self) > modl_to_int(other)
           ? 1
-        : self.value.integer == other.value.integer
+        : modl_to_int(self) == modl_to_int(other)
           ? 0 : -1;
     case ModlTypeFloating:
-    return self.value.floating > other.value.floating
+    return modl_to_double(self) > modl_to_double(other)
         ? 1
-      : self.value.floating == other.value.floating
+      : modl_to_double(self) == modl_to_double(other)
         ? 0 : -1;
-    case ModlTypeString: return strcmp(self.value.ref->value.string, other.value.ref->value.string);
+    case ModlTypeString: return strcmp(modl_to_ref(self)->value.string, modl_to_ref(other)->value.string);
     case ModlTypeTable: return -1;
     case ModlTypeFunction:
-      return (self.value.ref->value.fun.is_external == other.value.ref->value.fun.is_external
-           && self.value.ref->value.fun.position    == other.value.ref->value.fun.position
-           && self.value.ref->value.fun.context     == other.value.ref->value.fun.context) ? 0 : -1;
+      return (modl_to_ref(self)->value.fun.is_external == modl_to_ref(other)->value.fun.is_external
+           && modl_to_ref(self)->value.fun.position    == modl_to_ref(other)->value.fun.position
+           && modl_to_ref(self)->value.fun.context     == modl_to_ref(other)->value.fun.context) ? 0 : -1;
 
     default: return -1;
   }
@@ -314,9 +571,9 @@ struct ModlObject modl_object_copy_value(struct ModlObject self)
 struct ModlObject modl_maybe_cast(struct ModlObject object, enum ModlType target_type)
 {
   // printf("\x1b[32m  casting object from %d to %d\x1b[0m\n", object->type, target_type);
-  if (object.type == target_type) return object;
+  if (modl_object_type(object) == target_type) return object;
 
-  switch (object.type)
+  switch (modl_object_type(object))
   {
     case ModlTypeInteger: switch(target_type)
     {
@@ -329,7 +586,7 @@ struct ModlObject modl_maybe_cast(struct ModlObject object, enum ModlType target
   {
     printf(
       "\x1b[31;1m  Cannot cast object of type %s to %s\x1b[0m\n",
-      modl_types_names_table[object.type],
+      modl_types_names_table[modl_object_type(object)],
       modl_types_names_table[target_type]
     );
     exit(EXIT_FAILURE);
@@ -347,9 +604,9 @@ bool modl_table_has_k(struct ModlObject * self, struct ModlObject key)
     exit(EXIT_FAILURE);
   }
 
-  if (ModlTypeTable != self->type) return FALSE;
+  if (ModlTypeTable != modl_object_type(*self)) return FALSE;
 
-  return NULL != modl_map_get(&self->value.ref->value.table, key);
+  return NULL != modl_map_get(&modl_to_ref(*self)->value.table, key);
 
   // struct ModlTableNode * node =
   //   key->type == ModlTypeInteger
@@ -374,19 +631,19 @@ void modl_table_insert_kv(struct ModlObject * const self, struct ModlObject key,
     exit(EXIT_FAILURE);
   }
 
-  if (ModlTypeTable != self->type)
+  if (ModlTypeTable != modl_object_type(*self))
   {
     printf("\x1b[31;1m  %s\x1b[0m\n", "((ModlObject *) self)->type != ModlTypeTable!");
     exit(EXIT_FAILURE);
   }
 
-  if (ModlTypeString != key.type && ModlTypeInteger != key.type)
+  if (ModlTypeString != modl_object_type(key) && ModlTypeInteger != modl_object_type(key))
   {
     printf("\x1b[31;1m  %s\x1b[0m\n", "((ModlObject *) key)->type not in (ModlTypeString, ModlTypeInteger)!");
     exit(EXIT_FAILURE);
   }
 
-  modl_map_set(&self->value.ref->value.table, key, value);
+  modl_map_set(&modl_to_ref(*self)->value.table, key, value);
   modl_object_release_tmp(key);
 
   // if (ModlTypeInteger == key->type && NULL != self->value.table.last_consecutive_integer_node
@@ -455,11 +712,47 @@ void modl_table_insert_kv(struct ModlObject * const self, struct ModlObject key,
   // node->next = (struct ModlTableNode *) calloc(1, sizeof (struct ModlTableNode));
 }
 
+/*!
+ *  \brief Remove entry from table
+ *  \param self Table
+ *  \param key Key of the entry
+ *  \return TRUE if the entry existed
+ */
+bool modl_table_remove_k(struct ModlObject * self, struct ModlObject key)
+{
+  if (NULL == self)
+  {
+    printf("\x1b[31;1m  %s\x1b[0m\n", "((ModlObject*) self) == NULL!");
+    exit(EXIT_FAILURE);
+  }
+
+  if (ModlTypeTable != modl_object_type(*self))
+  {
+    printf("\x1b[31;1m  %s\x1b[0m\n", "((ModlObject *) self)->type != ModlTypeTable!");
+    exit(EXIT_FAILURE);
+  }
+
+  bool const removed = modl_map_remove(&modl_to_ref(*self)->value.table, key);
+  modl_object_release_tmp(key);
+  return removed;
+}
+
 void modl_table_push_v(struct ModlObject * self, struct ModlObject value)
 {
-  struct ModlObject next_id = int_to_modl(0);
-  while (modl_table_has_k(self, next_id)) next_id.value.integer += 1;
-  modl_table_insert_kv(self, next_id, value);
+  if (NULL == self)
+  {
+    printf("\x1b[31;1m  %s\x1b[0m\n", "((ModlObject*) self) == NULL!");
+    exit(EXIT_FAILURE);
+  }
+
+  if (ModlTypeTable != modl_object_type(*self))
+  {
+    printf("\x1b[31;1m  %s\x1b[0m\n", "((ModlObject *) self)->type != ModlTypeTable!");
+    exit(EXIT_FAILURE);
+  }
+
+  /* the first missing integer key is the one after the array part */
+  modl_map_push(&modl_to_ref(*self)->value.table, value);
   // struct ModlTableNode const * ln = self->value.table.last_consecutive_integer_node;
   // int64_t next_id = 0;
   // if (NULL != ln) next_id = ln->key->value.integer + 1;
@@ -467,7 +760,48 @@ void modl_table_push_v(struct ModlObject * self, struct ModlObject value)
 }
 
 
-static struct ModlObject index_string = { .type = ModlTypeNil };
+/*!
+ *  \brief Insert entries in bulk
+ *  \param self Table
+ *  \param keys Keys, strings or integers, NULL to push the values
+ *  \param values Values
+ *  \param count Number of entries
+ */
+void modl_table_insert_all(struct ModlObject * self, struct ModlObject const * keys, struct ModlObject const * values, size_t count)
+{
+  if (NULL == self)
+  {
+    printf("\x1b[31;1m  %s\x1b[0m\n", "((ModlObject*) self) == NULL!");
+    exit(EXIT_FAILURE);
+  }
+
+  if (ModlTypeTable != modl_object_type(*self))
+  {
+    printf("\x1b[31;1m  %s\x1b[0m\n", "((ModlObject *) self)->type != ModlTypeTable!");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; NULL != keys && i < count; ++i)
+  {
+    if (ModlTypeString != modl_object_type(keys[i]) && ModlTypeInteger != modl_object_type(keys[i]))
+    {
+      printf("\x1b[31;1m  %s\x1b[0m\n", "((ModlObject *) key)->type not in (ModlTypeString, ModlTypeInteger)!");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  modl_map_set_all(&modl_to_ref(*self)->value.table, keys, values, count);
+
+  for (size_t i = 0; NULL != keys && i < count; ++i)
+    modl_object_release_tmp(keys[i]);
+}
+
+int64_t modl_table_length(struct ModlObject const * self)
+{
+  return modl_to_ref(*self)->value.table.array_size;
+}
+
+static struct ModlObject index_string = { 0 };
 struct ModlObject modl_table_get_v(struct ModlObject const * self, struct ModlObject key)
 {
   if (NULL == self)
@@ -476,7 +810,7 @@ struct ModlObject modl_table_get_v(struct ModlObject const * self, struct ModlOb
     exit(EXIT_FAILURE);
   }
 
-  if (ModlTypeTable != self->type)
+  if (ModlTypeTable != modl_object_type(*self))
   {
     printf("\x1b[31;1m  %s\x1b[0m\n", "((ModlObject *) self)->type != ModlTypeTable!");
     exit(EXIT_FAILURE);
@@ -495,11 +829,11 @@ struct ModlObject modl_table_get_v(struct ModlObject const * self, struct ModlOb
   //   node = node->next;
   // }
 
-  struct ModlObject * ret = modl_map_get(&self->value.ref->value.table, key);
+  struct ModlObject * ret = modl_map_get(&modl_to_ref(*self)->value.table, key);
   if (NULL == ret)
   {
-    if (ModlTypeNil == index_string.type) index_string = modl_object_take(str_to_modl("__index"));
-    struct ModlObject * itbl = modl_map_get(&self->value.ref->value.table, index_string);
+    if (ModlTypeNil == modl_object_type(index_string)) index_string = modl_object_promote(modl_object_take(str_to_modl("__index")));
+    struct ModlObject * itbl = modl_map_get(&modl_to_ref(*self)->value.table, index_string);
     // if (ModlTypeFunction == itbl->type)
     //   return vm_call_function()
     // TODO: Do something with functions
@@ -518,12 +852,12 @@ void modl_object_display(struct ModlObject const * object)
     return;
   }
 
-  if (not modl_object_is_value_type(*object))
+  if (not modl_object_is_value_type(*object) && ModlTypeInteger != modl_object_type(*object))
   {
     printf("{%d}", modl_object_get_reference_count(*object));
   }
 
-  switch (object->type)
+  switch (modl_object_type(*object))
   {
     case ModlTypeNil:
     {
@@ -532,29 +866,29 @@ void modl_object_display(struct ModlObject const * object)
 
     case ModlTypeBoolean:
     {
-      printf("%s", object->value.boolean ? "true" : "false");
+      printf("%s", modl_to_bool(*object) ? "true" : "false");
     } break;
 
     case ModlTypeInteger:
     {
-      printf("\x1b[33m%ld\x1b[0m", object->value.integer);
+      printf("\x1b[33m%ld\x1b[0m", modl_to_int(*object));
     } break;
 
     case ModlTypeFloating:
     {
-      printf("\x1b[33m%.17g\x1b[0m", object->value.floating);
+      printf("\x1b[33m%.17g\x1b[0m", modl_to_double(*object));
     } break;
 
     case ModlTypeString:
     {
-      printf("\x1b[32m\"%s\"\x1b[0m", object->value.ref->value.string);
+      printf("\x1b[32m\"%s\"\x1b[0m", modl_to_ref(*object)->value.string);
     } break;
 
     case ModlTypeTable:
     {
       // printf("%s", "[ ... ]");
       // break;
-      modl_map_print(&object->value.ref->value.table);
+      modl_map_print(&modl_to_ref(*object)->value.table);
       // printf("%c", '[');
 
       // {
@@ -595,96 +929,139 @@ void modl_object_display(struct ModlObject const * object)
 
     case ModlTypeFunction:
     {
-      printf("\x1b[33;1m&%04lx\x1b[0m", object->value.ref->value.fun.position);
+      printf("\x1b[33;1m&%04lx\x1b[0m", modl_to_ref(*object)->value.fun.position);
     } break;
   }
 }
 
 
 
-#undef get16bits
-#if (defined(__GNUC__) && defined(__i386__)) || defined(__WATCOMC__) \
-  || defined(_MSC_VER) || defined (__BORLANDC__) || defined (__TURBOC__)
-#define get16bits(d) (*((const uint16_t *) (d)))
-#endif
+/*
+ *  Hashing is keyed with a per-process seed, so colliding keys cannot be
+ *  prepared in advance. The mixing follows wyhash: a 64 x 64 -> 128 bit
+ *  multiplication folded to 64 bits.
+ */
+#define MODL_HASH_P0 0xa0761d6478bd642full
+#define MODL_HASH_P1 0xe7037ed1a0b428dbull
+#define MODL_HASH_P2 0x8ebc6af09c88c6e3ull
 
-#if !defined (get16bits)
-#define get16bits(d) ((((uint32_t)(((const uint8_t *)(d))[1])) << 8)\
-                       +(uint32_t)(((const uint8_t *)(d))[0]) )
-#endif
+static uint64_t modl_hash_seed = MODL_HASH_P0;
 
-static uint32_t str_hash (char const * data, size_t len)
+static inline uint64_t modl_hash_mix(uint64_t a, uint64_t b)
 {
-  uint32_t hash = len, tmp;
-  int rem;
+  __uint128_t const r = (__uint128_t) a * b;
+  return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline uint64_t modl_hash_read64(char const * p)
+{ uint64_t v; memcpy(&v, p, sizeof v); return v; }
 
-  if (0 == len || NULL == data) return 0;
+static inline uint64_t modl_hash_read32(char const * p)
+{ uint32_t v; memcpy(&v, p, sizeof v); return v; }
 
-  rem = len & 3;
-  len >>= 2;
+static inline uint32_t int_hash(uint64_t value)
+{
+  return (uint32_t) modl_hash_mix(value ^ modl_hash_seed, MODL_HASH_P1 ^ modl_hash_seed);
+}
 
-  /* Main loop */
-  for (;len > 0; len--) {
-    hash  += get16bits (data);
-    tmp    = (get16bits (data+2) << 11) ^ hash;
-    hash   = (hash << 16) ^ tmp;
-    data  += 2*sizeof (uint16_t);
-    hash  += hash >> 11;
+/*!
+ *  \brief Hash of a string with known length
+ *
+ *  Long strings are consumed 32 bytes per step by two independent
+ *  multiply chains, so the multiplications of a step overlap.
+ *  \param data Characters, not necessarily null terminated
+ *  \param len Number of characters
+ */
+uint32_t modl_string_hash(char const * data, size_t len)
+{
+  size_t const length = len;
+  uint64_t h = modl_hash_seed ^ modl_hash_mix(modl_hash_seed ^ MODL_HASH_P0, MODL_HASH_P1);
+  uint64_t a = 0, b = 0;
+
+  if (len > 32)
+  {
+    uint64_t g = h;
+    for (; len > 32; len -= 32, data += 32)
+    {
+      h = modl_hash_mix(modl_hash_read64(data) ^ MODL_HASH_P1, modl_hash_read64(data + 8) ^ h);
+      g = modl_hash_mix(modl_hash_read64(data + 16) ^ MODL_HASH_P2, modl_hash_read64(data + 24) ^ g);
+    }
+    h ^= g;
   }
 
-  /* Handle end cases */
-  switch (rem) {
-    case 3: hash += get16bits (data);
-            hash ^= hash << 16;
-            hash ^= ((signed char)data[sizeof (uint16_t)]) << 18;
-            hash += hash >> 11;
-            break;
-    case 2: hash += get16bits (data);
-            hash ^= hash << 11;
-            hash += hash >> 17;
-            break;
-    case 1: hash += (signed char)*data;
-            hash ^= hash << 10;
-            hash += hash >> 1;
+  if (len > 16)
+  {
+    h = modl_hash_mix(modl_hash_read64(data) ^ MODL_HASH_P1, modl_hash_read64(data + 8) ^ h);
+    len -= 16;
+    data += 16;
+  }
+
+  /* the last 1 .. 16 bytes, reads may overlap */
+  if (len > 8)
+  {
+    a = modl_hash_read64(data);
+    b = modl_hash_read64(data + len - 8);
+  }
+  else if (len >= 4)
+  {
+    a = modl_hash_read32(data);
+    b = modl_hash_read32(data + len - 4);
+  }
+  else if (len > 0)
+  {
+    a = ((uint64_t) (uint8_t) data[0] << 16) | ((uint64_t) (uint8_t) data[len >> 1] << 8) | (uint8_t) data[len - 1];
   }
 
-  /* Force "avalanching" of final 127 bits */
-  hash ^= hash << 3;
-  hash += hash >> 5;
-  hash ^= hash << 4;
-  hash += hash >> 17;
-  hash ^= hash << 25;
-  hash += hash >> 6;
+  h = modl_hash_mix(a ^ MODL_HASH_P1, b ^ h);
+  return (uint32_t) modl_hash_mix(h ^ MODL_HASH_P2, length ^ MODL_HASH_P1);
+}
 
-  return hash;
+/*!
+ *  \brief Set the seed of object hashes
+ *
+ *  Hashes are cached in objects, so the seed has to be set before any
+ *  object is hashed.
+ *  \param seed Seed
+ */
+void modl_object_set_hash_seed(uint64_t seed)
+{
+  modl_hash_seed = seed ^ MODL_HASH_P0;
 }
 
 uint32_t modl_object_hash(struct ModlObject self)
 {
-  if (modl_object_is_value_type(self))
+  if (modl_object_is_value_type(self) || ModlTypeInteger == modl_object_type(self))
   {
-    switch (self.type)
+    switch (modl_object_type(self))
     {
       case ModlTypeNil: return 0u;
-      case ModlTypeBoolean: return 1u + (uint32_t) self.value.boolean;
-      case ModlTypeInteger: return self.value.integer;
-      case ModlTypeFloating: return (uint32_t) *((uint64_t*) &self.value.floating);
+      case ModlTypeBoolean: return 1u + (uint32_t) modl_to_bool(self);
+      case ModlTypeInteger: return int_hash((uint64_t) modl_to_int(self));
+      case ModlTypeFloating:
+      {
+        double const floating = modl_to_double(self);
+        uint64_t bits;
+        memcpy(&bits, &floating, sizeof bits);
+        return int_hash(bits);
+      }
+      default: break;
     }
   }
   else
   {
-    if (self.value.ref->has_hash)
-      return self.value.ref->hash;
+    if (modl_to_ref(self)->has_hash)
+      return modl_to_ref(self)->hash;
     
-    self.value.ref->has_hash = TRUE;
-    switch (self.type)
+    modl_to_ref(self)->has_hash = TRUE;
+    switch (modl_object_type(self))
     {
       case ModlTypeString:
-        return self.value.ref->hash = str_hash(self.value.ref->value.string, strlen(self.value.ref->value.string));
+        return modl_to_ref(self)->hash = modl_string_hash(modl_to_ref(self)->value.string, modl_to_ref(self)->string_length);
       case ModlTypeTable:
-        return self.value.ref->hash = (uint32_t) ((size_t) &self.value.ref->value.table);
+        return modl_to_ref(self)->hash = (uint32_t) ((size_t) &modl_to_ref(self)->value.table);
       case ModlTypeFunction:
-        return self.value.ref->hash = (((uint32_t) self.value.ref->value.fun.is_external) << 31u) ^ ((uint32_t) self.value.ref->value.fun.position);
+        return modl_to_ref(self)->hash = (((uint32_t) modl_to_ref(self)->value.fun.is_external) << 31u) ^ ((uint32_t) modl_to_ref(self)->value.fun.position);
+      default: break;
     }
   }
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string.h>
+
 #include "defs.h"
 
 
@@ -31,6 +33,26 @@ static char const * const modl_types_names_table[256] =
 
 
 struct ModlObjectReference;
+#ifdef MODL_NAN_BOXING
+/*
+ *  NaN-boxed object, built with MODL_NAN_BOXING: one 64-bit word. Doubles
+ *  are stored with their top 13 bits flipped and NaNs made positive and
+ *  quiet, so any other value has those bits clear. Such values keep their
+ *  type in bits 48-50 and a 48-bit payload below: the integer, the
+ *  boolean or the reference. Integers that do not fit the payload are
+ *  boxed in a reference. Zeroed memory is nil in both representations.
+ */
+struct ModlObject
+{
+  uint64_t bits;
+};
+
+#define MODL_NAN_DOUBLE_MASK 0xFFF8000000000000ull
+#define MODL_NAN_PAYLOAD 0x0000FFFFFFFFFFFFull
+#define MODL_NAN_TAG_SHIFT 48
+/* tag of integers boxed in a reference, the other tags are their type */
+#define MODL_NAN_TAG_BOXED ((uint64_t) ModlTypeFloating)
+#else
 struct ModlObject
 {
   enum ModlType type;
@@ -42,24 +64,81 @@ struct ModlObject
     struct ModlObjectReference * ref;
   } value;
 };
+#endif
+
+/* nil marking a slot without value, distinct from a stored nil */
+#ifdef MODL_NAN_BOXING
+inline struct ModlObject modl_unbound()
+{ return (struct ModlObject) { .bits = 1 }; }
+inline bool modl_object_is_unbound(struct ModlObject self)
+{ return 1 == self.bits; }
+#else
+inline struct ModlObject modl_unbound()
+{ return (struct ModlObject) { .type = ModlTypeNil, .value = { .integer = -1 } }; }
+inline bool modl_object_is_unbound(struct ModlObject self)
+{ return ModlTypeNil == self.type && -1 == self.value.integer; }
+#endif
 
 #include "object_reference.h"
 
 
 
 /*  BASE OBJECT METHODS  */
-struct ModlObject modl_object_make_ref();
+struct ModlObject modl_object_make_ref(enum ModlType type);
+struct ModlObject modl_object_box_int(int64_t data);
+
+#ifdef MODL_NAN_BOXING
+inline struct ModlObject modl_nil()
+{ return (struct ModlObject) { .bits = 0 }; }
+
+inline enum ModlType modl_object_type(struct ModlObject self)
+{
+  uint64_t const tag = self.bits >> MODL_NAN_TAG_SHIFT;
+  if (tag > 7) return ModlTypeFloating;
+  return MODL_NAN_TAG_BOXED == tag ? ModlTypeInteger : (enum ModlType) tag;
+}
+inline bool modl_object_is_value_type(struct ModlObject self)
+{
+  uint64_t const tag = self.bits >> MODL_NAN_TAG_SHIFT;
+  return tag < MODL_NAN_TAG_BOXED || tag > ModlTypeFunction;
+}
+
+inline struct ModlObject ref_to_modl(enum ModlType type, struct ModlObjectReference * ref)
+{ return (struct ModlObject) { .bits = (uint64_t) type << MODL_NAN_TAG_SHIFT | (uintptr_t) ref }; }
+inline struct ModlObjectReference * modl_to_ref(struct ModlObject self)
+{ return (struct ModlObjectReference *) (uintptr_t) (self.bits & MODL_NAN_PAYLOAD); }
+
+inline struct ModlObject bool_to_modl(bool data)
+{ return (struct ModlObject) { .bits = (uint64_t) ModlTypeBoolean << MODL_NAN_TAG_SHIFT | (data ? 1 : 0) }; }
+
+inline struct ModlObject int_to_modl(int64_t data)
+{
+  if ((int64_t) ((uint64_t) data << 16) >> 16 != data)
+    return modl_object_box_int(data);
+  return (struct ModlObject) { .bits = (uint64_t) ModlTypeInteger << MODL_NAN_TAG_SHIFT | ((uint64_t) data & MODL_NAN_PAYLOAD) };
+}
 
+inline struct ModlObject double_to_modl(double data)
+{
+  uint64_t bits;
+  memcpy(&bits, &data, sizeof bits);
+  if (data != data) bits = 0x7FF8000000000000ull;
+  return (struct ModlObject) { .bits = bits ^ MODL_NAN_DOUBLE_MASK };
+}
+#else
 inline struct ModlObject modl_nil()
 { return  (struct ModlObject) { .type = ModlTypeNil }; }
-struct ModlObject modl_table();
-struct ModlObject modl_table_new();
 
-inline bool modl_object_type_is(struct ModlObject self, enum ModlType type)
-{ return self.type == type; }
+inline enum ModlType modl_object_type(struct ModlObject self)
+{ return self.type; }
 inline bool modl_object_is_value_type(struct ModlObject self)
 { return self.type <= ModlTypeFloating; }
 
+inline struct ModlObject ref_to_modl(enum ModlType type, struct ModlObjectReference * ref)
+{ return (struct ModlObject) { .type = type, .value = { .ref = ref }}; }
+inline struct ModlObjectReference * modl_to_ref(struct ModlObject self)
+{ return self.value.ref; }
+
 inline struct ModlObject bool_to_modl(bool data)
 { return (struct ModlObject) { .type = ModlTypeBoolean, .value = { .boolean = data }}; }
 
@@ -68,9 +147,20 @@ inline struct ModlObject int_to_modl(int64_t data)
 
 inline struct ModlObject double_to_modl(double data)
 { return (struct ModlObject) { .type = ModlTypeFloating, .value = { .floating = data }}; }
+#endif
+
+struct ModlObject modl_table();
+struct ModlObject modl_table_new();
+struct ModlObject modl_table_with_capacity(size_t array_count, size_t hash_count);
+
+inline bool modl_object_type_is(struct ModlObject self, enum ModlType type)
+{ return modl_object_type(self) == type; }
 
 struct ModlObject transfer_str_to_modl(char * data);
+struct ModlObject transfer_str_to_modl_n(char * data, size_t length);
 struct ModlObject str_to_modl(char const * data);
+struct ModlObject str_to_modl_n(char const * data, size_t length);
+struct ModlObject str_concat_to_modl(char const * a, size_t length_a, char const * b, size_t length_b);
 struct ModlObject ifun_to_modl(struct Environment * environment, uint64_t position);
 struct ModlObject efun_to_modl(uint64_t pointer);
 
@@ -83,14 +173,53 @@ struct ModlObject modl_object_disown(struct ModlObject self);
 bool modl_object_release(struct ModlObject self);
 bool modl_object_release_tmp(struct ModlObject self);
 int32_t modl_object_get_reference_count(struct ModlObject self);
+struct ModlObject modl_object_promote(struct ModlObject self);
+
+/* entries a queued table releases at a time */
+#define MODL_RELEASE_STEP 64
+/* tables with fewer slots and entries are disposed at once, unless they
+   are released by the dispose of another table */
+#define MODL_RELEASE_INLINE_COST 64
+
+struct ModlReleaseStats
+{
+  /* tables queued, most queued at a time and entries released */
+  size_t queued, max_pending, released;
+};
+
+void modl_object_release_queue_init(size_t capacity);
+size_t modl_object_release_pending(size_t budget);
+void modl_object_release_queue_free(void);
+void modl_object_release_queue_stats(struct ModlReleaseStats * stats);
 
 struct ModlObject modl_object_copy_value(struct ModlObject self);
 
 bool modl_object_equals(struct ModlObject self, struct ModlObject other);
 int modl_object_cmp(struct ModlObject self, struct ModlObject other);
 uint32_t modl_object_hash(struct ModlObject self);
+uint32_t modl_string_hash(char const * data, size_t len);
+void modl_object_set_hash_seed(uint64_t seed);
 
 /*  CONVERTERS  */
+#ifdef MODL_NAN_BOXING
+inline bool modl_to_bool(struct ModlObject object)
+{ return ((byte) object.bits ? TRUE : FALSE); }
+
+inline int64_t modl_to_int(struct ModlObject object)
+{
+  if (MODL_NAN_TAG_BOXED == object.bits >> MODL_NAN_TAG_SHIFT)
+    return modl_to_ref(object)->value.integer;
+  return (int64_t) (object.bits << 16) >> 16;
+}
+
+inline double modl_to_double(struct ModlObject object)
+{
+  uint64_t const bits = object.bits ^ MODL_NAN_DOUBLE_MASK;
+  double data;
+  memcpy(&data, &bits, sizeof data);
+  return data;
+}
+#else
 inline bool modl_to_bool(struct ModlObject object)
 { return (object.value.boolean ? TRUE : FALSE); }
 
@@ -99,6 +228,7 @@ inline int64_t modl_to_int(struct ModlObject object)
 
 inline double modl_to_double(struct ModlObject object)
 { return object.value.floating; }
+#endif
 
 char const * modl_to_str(struct ModlObject object);
 
@@ -108,7 +238,10 @@ struct ModlObject modl_maybe_cast(struct ModlObject object, enum ModlType target
 /*  TABLE METHODS  */
 bool modl_table_has_k(struct ModlObject * self, struct ModlObject key);
 void modl_table_insert_kv(struct ModlObject * self, struct ModlObject key, struct ModlObject value);
+bool modl_table_remove_k(struct ModlObject * self, struct ModlObject key);
 void modl_table_push_v(struct ModlObject * self, struct ModlObject value);
+void modl_table_insert_all(struct ModlObject * self, struct ModlObject const * keys, struct ModlObject const * values, size_t count);
+int64_t modl_table_length(struct ModlObject const * self);
 struct ModlObject modl_table_get_v(struct ModlObject const * self, struct ModlObject key);
 
 
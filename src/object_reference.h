@@ -5,6 +5,15 @@
 #include "object.h"
 
 
+/* marks of the cycle collector, see collector.h */
+enum __attribute__ ((__packed__)) ModlColor
+{
+  ModlColorBlack,
+  ModlColorGray,
+  ModlColorWhite,
+  ModlColorPurple,
+};
+
 struct ModlObjectReference
 {
   union
@@ -18,10 +27,26 @@ struct ModlObjectReference
     } fun;
 
     char * string;
+
+#ifdef MODL_NAN_BOXING
+    /* integer that does not fit a NaN-boxed object */
+    int64_t integer;
+#endif
   } value;
 
   int32_t count;
   uint32_t hash;
+  union
+  {
+    /* size of a pooled string buffer, 0 if it is from malloc */
+    uint32_t string_size;
+    /* position of a buffered table in the candidates of the collector */
+    uint32_t root_index;
+  };
+  /* number of characters of a string */
+  uint32_t string_length;
 
   bool has_hash;
+  enum ModlColor color;
+  bool buffered;
 };
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pool.h"
+#include "object.h"
+
+
+#define MODL_POOL_ALIGNMENT 16
+#define MODL_POOL_ALIGN(size) (((size) + MODL_POOL_ALIGNMENT - 1) & ~(size_t) (MODL_POOL_ALIGNMENT - 1))
+
+/* slabs and region chunks are aligned to their size, so the header of
+   any pooled pointer is found by masking it */
+struct ModlPoolSlab
+{
+  struct ModlPoolSlab * next;
+  /* region the chunk belongs to, NULL for slabs of a class */
+  struct ModlRegion * region;
+};
+
+struct ModlRegion
+{
+  struct ModlRegion * parent;
+  struct ModlPoolSlab * chunks;
+  char * bump;
+  char * end;
+  /* allocations not freed yet */
+  size_t live;
+  bool ended;
+};
+
+struct ModlPoolClass
+{
+  size_t const slot_size;
+  /* freed slots, linked through their first bytes */
+  void * free;
+  /* not yet handed out part of the newest slab */
+  char * bump;
+  char * end;
+  struct ModlPoolSlab * slabs;
+  size_t slab_count, slots, used, allocations;
+};
+
+static struct ModlPoolClass modl_pool_classes[MODL_POOL_CLASSES] = {
+  { .slot_size = MODL_POOL_ALIGN(sizeof (struct ModlObjectReference)) },
+  { .slot_size = MODL_POOL_STRING_MIN_SIZE },
+  { .slot_size = MODL_POOL_STRING_MIN_SIZE << 1 },
+  { .slot_size = MODL_POOL_STRING_MIN_SIZE << 2 },
+  { .slot_size = MODL_POOL_STRING_MIN_SIZE << 3 },
+};
+
+static size_t modl_pool_large_allocations = 0;
+
+/* innermost region allocations come from, NULL outside of regions */
+static struct ModlRegion * modl_pool_region = NULL;
+/* chunks of reset regions, reused by the next ones */
+static struct ModlPoolSlab * modl_pool_spare_chunks = NULL;
+static size_t modl_pool_spare_count = 0;
+static size_t modl_pool_region_count = 0, modl_pool_region_resets = 0, modl_pool_region_deferred = 0;
+static size_t modl_pool_region_chunks = 0;
+
+#ifndef MODL_NO_POOL
+static inline struct ModlPoolSlab * modl_pool_slab_of(void const * slot)
+{
+  return (struct ModlPoolSlab *) ((uintptr_t) slot & ~(uintptr_t) (MODL_POOL_SLAB_SIZE - 1));
+}
+
+static inline size_t modl_pool_slab_header(void)
+{
+  return MODL_POOL_ALIGN(sizeof (struct ModlPoolSlab));
+}
+
+static struct ModlPoolSlab * modl_pool_slab_new(struct ModlRegion * region)
+{
+  struct ModlPoolSlab * slab = aligned_alloc(MODL_POOL_SLAB_SIZE, MODL_POOL_SLAB_SIZE);
+  if (NULL == slab)
+  {
+    printf("\x1b[31;1m%s\x1b[0m\n", "  failed to allocate object slab");
+    exit(EXIT_FAILURE);
+  }
+  slab->region = region;
+  return slab;
+}
+
+
+static inline size_t modl_pool_string_class(size_t size)
+{
+  size_t class = 1;
+  for (size_t slot_size = MODL_POOL_STRING_MIN_SIZE; slot_size < size; slot_size <<= 1)
+    class += 1;
+  return class;
+}
+
+static void * modl_pool_class_alloc(struct ModlPoolClass * class)
+{
+  class->used += 1;
+  class->allocations += 1;
+
+  if (NULL != class->free)
+  {
+    void * slot = class->free;
+    class->free = *(void **) slot;
+    return slot;
+  }
+
+  if (class->bump == class->end)
+  {
+    struct ModlPoolSlab * slab = modl_pool_slab_new(NULL);
+    slab->next = class->slabs;
+    class->slabs = slab;
+    class->slab_count += 1;
+
+    size_t const header = modl_pool_slab_header();
+    class->bump = (char *) slab + header;
+    class->end = class->bump + (MODL_POOL_SLAB_SIZE - header) / class->slot_size * class->slot_size;
+  }
+
+  void * slot = class->bump;
+  class->bump += class->slot_size;
+  class->slots += 1;
+  return slot;
+}
+
+static inline void modl_pool_class_free(struct ModlPoolClass * class, void * slot)
+{
+  *(void **) slot = class->free;
+  class->free = slot;
+  class->used -= 1;
+}
+
+
+static struct ModlPoolSlab * modl_pool_chunk_new(struct ModlRegion * region)
+{
+  struct ModlPoolSlab * chunk = modl_pool_spare_chunks;
+  if (NULL == chunk)
+  {
+    chunk = modl_pool_slab_new(region);
+    modl_pool_region_chunks += 1;
+  }
+  else
+  {
+    modl_pool_spare_chunks = chunk->next;
+    modl_pool_spare_count -= 1;
+    chunk->region = region;
+  }
+  return chunk;
+}
+
+static void * modl_pool_region_alloc(struct ModlRegion * region, size_t size)
+{
+  size = MODL_POOL_ALIGN(size);
+  if ((size_t) (region->end - region->bump) < size)
+  {
+    struct ModlPoolSlab * chunk = modl_pool_chunk_new(region);
+    chunk->next = region->chunks;
+    region->chunks = chunk;
+    region->bump = (char *) chunk + modl_pool_slab_header();
+    region->end = (char *) chunk + MODL_POOL_SLAB_SIZE;
+  }
+
+  void * slot = region->bump;
+  region->bump += size;
+  region->live += 1;
+  return slot;
+}
+#endif
+
+/* all chunks of the region go back to the spare list, the region itself
+   lives in the last of them */
+static void modl_pool_region_reset(struct ModlRegion * region)
+{
+  struct ModlPoolSlab * chunk = region->chunks;
+  while (NULL != chunk)
+  {
+    struct ModlPoolSlab * next = chunk->next;
+    if (modl_pool_spare_count < MODL_POOL_SPARE_CHUNKS)
+    {
+      chunk->next = modl_pool_spare_chunks;
+      modl_pool_spare_chunks = chunk;
+      modl_pool_spare_count += 1;
+    }
+    else
+    {
+      free(chunk);
+      modl_pool_region_chunks -= 1;
+    }
+    chunk = next;
+  }
+}
+
+static inline void modl_pool_region_free(struct ModlRegion * region)
+{
+  region->live -= 1;
+  if (region->ended && 0 == region->live) modl_pool_region_reset(region);
+}
+
+
+struct ModlRegion * modl_pool_region_begin(void)
+{
+#ifdef MODL_NO_POOL
+  return NULL;
+#else
+  struct ModlPoolSlab * chunk = modl_pool_chunk_new(NULL);
+  struct ModlRegion * region = (struct ModlRegion *) ((char *) chunk + modl_pool_slab_header());
+  chunk->next = NULL;
+  chunk->region = region;
+
+  *region = (struct ModlRegion) {
+    .parent = modl_pool_region,
+    .chunks = chunk,
+    .bump = (char *) region + MODL_POOL_ALIGN(sizeof (struct ModlRegion)),
+    .end = (char *) chunk + MODL_POOL_SLAB_SIZE,
+  };
+  modl_pool_region = region;
+  modl_pool_region_count += 1;
+  return region;
+#endif
+}
+
+void modl_pool_region_leave(struct ModlRegion * region)
+{
+  if (NULL == region) return;
+
+  modl_pool_region = region->parent;
+}
+
+void modl_pool_region_end(struct ModlRegion * region)
+{
+  if (NULL == region) return;
+
+  modl_pool_region = region->parent;
+  region->ended = TRUE;
+  if (0 == region->live)
+  {
+    modl_pool_region_resets += 1;
+    modl_pool_region_reset(region);
+  }
+  else modl_pool_region_deferred += 1;
+}
+
+struct ModlRegion * modl_pool_region_suspend(void)
+{
+  struct ModlRegion * const region = modl_pool_region;
+  modl_pool_region = NULL;
+  return region;
+}
+
+void modl_pool_region_resume(struct ModlRegion * region)
+{
+  modl_pool_region = region;
+}
+
+bool modl_pool_region_is_nested(struct ModlRegion const * region)
+{
+  return NULL != region && NULL != region->parent;
+}
+
+bool modl_pool_in_region(void const * data)
+{
+  return NULL != modl_pool_region_of(data);
+}
+
+struct ModlRegion * modl_pool_region_of(void const * data)
+{
+#ifdef MODL_NO_POOL
+  return NULL;
+#else
+  return modl_pool_slab_of(data)->region;
+#endif
+}
+
+
+void * modl_pool_alloc_ref(void)
+{
+#ifdef MODL_NO_POOL
+  return malloc(sizeof (struct ModlObjectReference));
+#else
+  if (NULL != modl_pool_region)
+    return modl_pool_region_alloc(modl_pool_region, sizeof (struct ModlObjectReference));
+  return modl_pool_class_alloc(&modl_pool_classes[0]);
+#endif
+}
+
+void modl_pool_free_ref(void * ref)
+{
+#ifdef MODL_NO_POOL
+  free(ref);
+#else
+  struct ModlPoolSlab * slab = modl_pool_slab_of(ref);
+  if (NULL != slab->region) modl_pool_region_free(slab->region);
+  else modl_pool_class_free(&modl_pool_classes[0], ref);
+#endif
+}
+
+char * modl_pool_alloc_string(size_t size)
+{
+#ifndef MODL_NO_POOL
+  if (size <= MODL_POOL_STRING_MAX_SIZE)
+  {
+    if (NULL != modl_pool_region) return modl_pool_region_alloc(modl_pool_region, size);
+    return modl_pool_class_alloc(&modl_pool_classes[modl_pool_string_class(size)]);
+  }
+
+  modl_pool_large_allocations += 1;
+#endif
+  return malloc(size);
+}
+
+void modl_pool_free_string(char * data, size_t size)
+{
+#ifndef MODL_NO_POOL
+  if (size <= MODL_POOL_STRING_MAX_SIZE)
+  {
+    struct ModlPoolSlab * slab = modl_pool_slab_of(data);
+    if (NULL != slab->region) modl_pool_region_free(slab->region);
+    else modl_pool_class_free(&modl_pool_classes[modl_pool_string_class(size)], data);
+    return;
+  }
+#endif
+  free(data);
+}
+
+
+void modl_pool_stats(struct ModlPoolStats * stats)
+{
+  for (size_t i = 0; i < MODL_POOL_CLASSES; ++i)
+  {
+    struct ModlPoolClass const * class = &modl_pool_classes[i];
+    stats->classes[i] = (struct ModlPoolClassStats) {
+      .slot_size = class->slot_size,
+      .slabs = class->slab_count,
+      .slots = class->slots,
+      .used = class->used,
+      .allocations = class->allocations,
+    };
+  }
+  stats->large_allocations = modl_pool_large_allocations;
+  stats->regions = modl_pool_region_count;
+  stats->region_resets = modl_pool_region_resets;
+  stats->region_deferred = modl_pool_region_deferred;
+  stats->region_chunks = modl_pool_region_chunks;
+}
+
+void modl_pool_release_all(void)
+{
+  for (size_t i = 0; i < MODL_POOL_CLASSES; ++i)
+  {
+    struct ModlPoolClass * class = &modl_pool_classes[i];
+    while (NULL != class->slabs)
+    {
+      struct ModlPoolSlab * next = class->slabs->next;
+      free(class->slabs);
+      class->slabs = next;
+    }
+
+    class->free = NULL;
+    class->bump = class->end = NULL;
+    class->slab_count = class->slots = class->used = 0;
+  }
+
+  while (NULL != modl_pool_spare_chunks)
+  {
+    struct ModlPoolSlab * next = modl_pool_spare_chunks->next;
+    free(modl_pool_spare_chunks);
+    modl_pool_spare_chunks = next;
+    modl_pool_region_chunks -= 1;
+  }
+  modl_pool_spare_count = 0;
+}
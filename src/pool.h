@@ -0,0 +1,102 @@
+#pragma once
+
+#include "defs.h"
+
+
+/*
+ *  Slab allocator for object references and short string buffers. Each
+ *  size class takes MODL_POOL_SLAB_SIZE bytes at a time from malloc and
+ *  hands out fixed-size slots from them; freed slots go on a per-class
+ *  free list and are reused before the slab is bumped any further.
+ *  Strings longer than the largest class use malloc directly.
+ *
+ *  Slabs are only returned to malloc by modl_pool_release_all, which the
+ *  VM calls once all objects are gone. Building with MODL_NO_POOL makes
+ *  every allocation a plain malloc, e.g. for leak checkers.
+ */
+
+/*
+ *  While a region is open, references and pooled strings are bumped from
+ *  its chunks instead, and freeing them only counts them down. Ending a
+ *  region resets it at once if nothing allocated in it is alive; else
+ *  the reset is deferred until the last of those objects is freed.
+ *  Regions nest, objects come from the innermost one.
+ */
+
+#define MODL_POOL_SLAB_SIZE 16384
+/* string buffers of 16, 32, 64 and 128 bytes */
+#define MODL_POOL_STRING_CLASSES 4
+#define MODL_POOL_STRING_MIN_SIZE 16
+#define MODL_POOL_STRING_MAX_SIZE (MODL_POOL_STRING_MIN_SIZE << (MODL_POOL_STRING_CLASSES - 1))
+/* class 0 holds references */
+#define MODL_POOL_CLASSES (MODL_POOL_STRING_CLASSES + 1)
+/* chunks kept for the next region after a reset */
+#define MODL_POOL_SPARE_CHUNKS 16
+
+struct ModlRegion;
+
+
+struct ModlPoolClassStats
+{
+  size_t slot_size;
+  size_t slabs;
+  /* slots handed out at least once and slots currently in use */
+  size_t slots, used;
+  size_t allocations;
+};
+
+struct ModlPoolStats
+{
+  struct ModlPoolClassStats classes[MODL_POOL_CLASSES];
+  /* strings too long for a class */
+  size_t large_allocations;
+  /* regions begun, reset when they ended and reset later */
+  size_t regions, region_resets, region_deferred;
+  /* chunks allocated for regions, spare ones included */
+  size_t region_chunks;
+};
+
+
+void * modl_pool_alloc_ref(void);
+void modl_pool_free_ref(void * ref);
+
+/*!
+ *  \brief Buffer of at least size bytes
+ *  \return Buffer to free with modl_pool_free_string and the same size
+ */
+char * modl_pool_alloc_string(size_t size);
+void modl_pool_free_string(char * data, size_t size);
+
+struct ModlRegion * modl_pool_region_begin(void);
+/*!
+ *  \brief Stop allocating from region, which must be the innermost one
+ *
+ *  Objects to keep can be promoted before the region ends.
+ */
+void modl_pool_region_leave(struct ModlRegion * region);
+/*!
+ *  \brief Leave region and reset it once nothing allocated in it is alive
+ */
+void modl_pool_region_end(struct ModlRegion * region);
+/*!
+ *  \brief Allocate outside of regions until modl_pool_region_resume
+ *  \return Innermost open region, NULL if none is
+ */
+struct ModlRegion * modl_pool_region_suspend(void);
+void modl_pool_region_resume(struct ModlRegion * region);
+bool modl_pool_in_region(void const * data);
+/*!
+ *  \brief Whether region was begun while another one was open
+ */
+bool modl_pool_region_is_nested(struct ModlRegion const * region);
+/*!
+ *  \brief Region pooled data was allocated from, NULL if from none
+ */
+struct ModlRegion * modl_pool_region_of(void const * data);
+
+void modl_pool_stats(struct ModlPoolStats * stats);
+
+/*!
+ *  \brief Return all slabs to malloc, every pooled object must be dead
+ */
+void modl_pool_release_all(void);
@@ -10,25 +10,128 @@
 #include "defs.h"
 #include "instructions.h"
 #include "object.h"
+#include "pool.h"
+#include "collector.h"
 #include "sebo.h"
 
 
 #define VM_SETTING_REGITERS_COUNT 16
+#define VM_SETTING_BINDING_EPOCHS_COUNT 256
+/* dead tables are disposed a bounded number of entries per safepoint,
+   0 disposes of them at once */
+#define VM_RELEASE_QUEUE_SIZE 1024
+#define VM_SETTING_RELEASE_BUDGET 256
+/* tables buffered as possible roots of cycles before a collection runs,
+   0 disables the cycle collector */
+#define VM_SETTING_CYCLE_CANDIDATES 10000
 static bool VM_SETTING_SILENT = FALSE;
+static bool VM_SETTING_STATS = FALSE;
+
+/* labels-as-values dispatch, the default only with VM_FAST where it measured
+   faster; define VM_THREADED_DISPATCH or VM_SWITCH_DISPATCH to choose */
+#if !defined(VM_THREADED_DISPATCH) && !defined(VM_SWITCH_DISPATCH) && defined(VM_FAST) \
+  && (defined(__GNUC__) || defined(__clang__))
+#define VM_THREADED_DISPATCH
+#endif
 
 
+/*!
+ *  \brief Activation environment
+ *
+ *  Variables live in a flat slot array. The nametable maps names to slot
+ *  ids and is shared by all activations of the same function, so a name
+ *  has the same slot in every activation. Slots below next_variable_id are
+ *  allocated; a slot holds modl_unbound() until the name is set in this
+ *  activation. Environments of calls are pooled per call stack depth and
+ *  keep their variables storage between activations.
+ */
 struct Environment
 {
   struct Environment * parent;
-  struct ModlObject vartable;
+  struct ModlObject * variables;
   struct ModlObject nametable;
   uint64_t next_variable_id;
+  uint64_t variables_capacity;
+  /* distinguishes activations that reuse the same pooled environment */
+  uint64_t activation;
+  /* signature of the activations of the parents */
+  uint64_t ancestry;
+  /* a function was created in it, so it may outlive its call frame */
+  bool captured;
+};
+
+/*!
+ *  \brief Inline cache of OP_ENVGETC, OP_ENVSETC and OP_ENVARGC
+ *
+ *  Remembers the environment holding the variable, its depth and the slot
+ *  of the variable. The signature is computed from the nametable of the
+ *  current environment and the activations of its parents, so equal
+ *  signatures mean the same parents and the variable is found without
+ *  walking them, unless that environment was reused by another activation
+ *  since. A lookup is cached only if none of the nearer nametables
+ *  has the name, and names are added to nametables only with a bump of the
+ *  binding epoch, so equal signature and epoch mean no nearer environment
+ *  can shadow it. Setters only remember the slot of the name in the
+ *  nametable stored as the signature.
+ */
+struct EnvironmentCache
+{
+  uint64_t signature;
+  struct Environment * environment;
+  uint64_t activation;
+  uint32_t depth;
+  uint32_t slot;
+  uint32_t epoch;
+  byte epoch_slot;
+};
+
+/*!
+ *  \brief Inline cache of OP_TBLGETR and OP_TBLSETR
+ *
+ *  Remembers the slot of the key in tables of a shape. A setter that added
+ *  the key also remembers the shape the table moved to, so tables built by
+ *  the same code skip the search for the shape. The cache holds references
+ *  to the key and the shapes, so their addresses cannot be reused by
+ *  others while it compares them.
+ */
+struct TableCache
+{
+  struct ModlShape * shape;
+  struct ModlShape * target;
+  struct ModlObject key;
+  uint32_t slot;
 };
 
+/*!
+ *  \brief Call stack entry
+ *
+ *  Arguments passed by OP_CALLW are copied to the stack window starting at
+ *  arguments; the frame owns the stack above it and releases it on return.
+ *  Calls made by OP_CALLR pass arguments through OP_PUSH/OP_POP and have
+ *  argc = 0. A frame that executed OP_REGION holds the region its objects
+ *  are allocated in, it ends when the frame returns.
+ */
 struct CallFrame
 {
   size_t return_address;
   struct Environment * environment;
+  size_t arguments;
+  uint32_t argc;
+  struct ModlRegion * region;
+};
+
+struct VMState;
+
+/*!
+ *  \brief Native function
+ *
+ *  Arguments are borrowed from the caller, argv[0] is the first one.
+ *  Arity is the number of values OP_CALLR pops from the stack for the call.
+ */
+struct ExternalFunction
+{
+  struct ModlObject (* function) (struct VMState * vm, uint32_t argc, struct ModlObject const * argv);
+  uint32_t arity;
 };
 
 struct RegisterAccessMonitor
@@ -39,7 +142,10 @@ struct RegisterAccessMonitor
 
 struct VMState
 {
-  byte * code;
+  struct Instruction * code;
+  struct ModlObject * constants;
+  size_t code_length;
+  uint32_t constants_count, table_caches_count;
 
   size_t const max_count_call_stack, max_count_stack, max_count_externals;
 
@@ -47,9 +153,21 @@ struct VMState
   size_t efc;
 
   struct CallFrame  * call_stack;
+  struct EnvironmentCache * environment_caches;
+  struct TableCache * table_caches;
+  struct ModlObject * nametables;
+  struct Environment * environments;
+  uint32_t binding_epochs[VM_SETTING_BINDING_EPOCHS_COUNT];
+  uint64_t activations;
+  uint64_t environment_cache_hits, environment_cache_misses;
+  uint64_t table_cache_hits, table_cache_misses;
+  uint64_t quickenings, deoptimizations;
+  uint64_t tail_calls;
+  uint64_t region_promotions;
+
   struct ModlObject registers[VM_SETTING_REGITERS_COUNT];
   struct ModlObject *stack;
-  struct ModlObject (* *external_functions) (struct VMState *);
+  struct ExternalFunction * external_functions;
 
   struct RegisterAccessMonitor ram;
 };
@@ -81,13 +199,165 @@ struct Environment * vm_get_current_environment(struct VMState const * self)
   return vm_get_current_call_frame(self).environment;
 }
 
+static inline bool vm_variable_is_bound(struct ModlObject const * variable)
+{
+  return not modl_object_is_unbound(*variable);
+}
+
+/* identifies the nametable of the environment and the activations of its parents */
+static inline uint64_t vm_environment_signature(struct Environment const * env)
+{
+  return (env->ancestry ^ (uintptr_t) modl_to_ref(env->nametable)) * 0x9E3779B97F4A7C15ull;
+}
+
+/*!
+ *  \brief Get shared nametable of the function
+ *  \param self Virtual machine instance
+ *  \param position Function entry point
+ *  \return Nametable used by all activations of the function
+ */
+static inline struct ModlObject vm_get_nametable(struct VMState * self, uint64_t position)
+{
+  struct ModlObject * nametable = &self->nametables[position];
+  /* nametables outlive the region of the call that needed them first */
+  if (ModlTypeNil == modl_object_type(*nametable))
+    *nametable = modl_object_promote(modl_table_new());
+  return *nametable;
+}
+
+/*!
+ *  \brief Get slot id of the name, adding it to the nametable if missing
+ *  \param self Virtual machine instance
+ *  \param nametable Nametable
+ *  \param name Variable name
+ *  \return Slot id
+ */
+uint32_t vm_nametable_define(struct VMState * self, struct ModlObject nametable, struct ModlObject name)
+{
+  struct ModlMap * names = &modl_to_ref(nametable)->value.table;
+  struct ModlObject const * id = modl_map_get(names, name);
+  if (NULL != id) return (uint32_t) modl_to_int(*id);
+
+  /* the name may now shadow cached lookups in outer environments */
+  self->binding_epochs[modl_object_hash(name) % VM_SETTING_BINDING_EPOCHS_COUNT] += 1;
+
+  uint32_t const slot = names->size;
+  modl_map_set(names, name, int_to_modl(slot));
+  return slot;
+}
+
+/*!
+ *  \brief Store value in environment slot
+ *  \param env Environment
+ *  \param slot Slot id
+ *  \param value Variable value
+ */
+static inline void vm_environment_store(struct Environment * env, uint32_t slot, struct ModlObject value)
+{
+  if (slot >= env->next_variable_id)
+  {
+    uint64_t const count = modl_to_ref(env->nametable)->value.table.size;
+    if (count > env->variables_capacity)
+    {
+      env->variables_capacity = count > 2 * env->variables_capacity ? count : 2 * env->variables_capacity;
+      env->variables = realloc(env->variables, env->variables_capacity * sizeof (struct ModlObject));
+    }
+    for (uint64_t i = env->next_variable_id; i < count; ++i)
+      env->variables[i] = modl_unbound();
+    env->next_variable_id = count;
+  }
+
+  struct ModlObject const old = env->variables[slot];
+  env->variables[slot] = modl_object_take(value);
+  modl_object_release(old);
+}
+
+/*!
+ *  \brief Start a new activation in a released environment
+ *  \param self Virtual machine instance
+ *  \param env Environment with no variables set
+ *  \param parent Parent environment
+ *  \param nametable Nametable of the called function
+ */
+static inline void vm_environment_enter(struct VMState * self, struct Environment * env, struct Environment * parent, struct ModlObject nametable)
+{
+  env->parent = parent;
+  env->nametable = modl_object_take(nametable);
+  env->activation = ++self->activations;
+  env->ancestry = NULL == parent ? 0 : (parent->ancestry ^ parent->activation) * 0x9E3779B97F4A7C15ull;
+}
+
+/*!
+ *  \brief Take pooled environment for the next call frame
+ *  \param self Virtual machine instance
+ *  \param parent Parent environment
+ *  \param nametable Nametable of the called function
+ *  \return Environment with no variables set
+ */
+static inline struct Environment * vm_environment_acquire(struct VMState * self, struct Environment * parent, struct ModlObject nametable)
+{
+  struct Environment * env = &self->environments[self->csp + 1];
+  vm_environment_enter(self, env, parent, nametable);
+  return env;
+}
+
+/*!
+ *  \brief Release variables of environment, keeping its storage for reuse
+ *  \param env Environment
+ */
+static inline void vm_environment_release(struct Environment * env)
+{
+  for (uint64_t i = 0; i < env->next_variable_id; ++i)
+    modl_object_release(env->variables[i]);
+  env->next_variable_id = 0;
+  env->captured = FALSE;
+  modl_object_release(env->nametable);
+  env->nametable = modl_nil();
+}
+
+/*!
+ *  \brief Get slot of the instruction's name constant in the environment
+ *  \param self Virtual machine instance
+ *  \param instruction OP_ENVSETC or OP_ENVARGC
+ *  \param env Current environment
+ *  \return Slot id, cached per nametable in the inline cache of instruction
+ */
+static inline uint32_t vm_environment_cached_slot(struct VMState * self, struct Instruction const * instruction, struct Environment * env)
+{
+  struct EnvironmentCache * const cache = &self->environment_caches[instruction->a[1].cache];
+  if (cache->signature != (uintptr_t) modl_to_ref(env->nametable))
+  {
+    cache->signature = (uintptr_t) modl_to_ref(env->nametable);
+    cache->slot = vm_nametable_define(self, env->nametable, self->constants[instruction->a[1].constant]);
+  }
+  return cache->slot;
+}
+
+/*!
+ *  \brief Set variable in environment
+ *  \param self Virtual machine instance
+ *  \param env Environment
+ *  \param key Variable name
+ *  \param value Variable value
+ */
+void vm_environment_set(struct VMState * self, struct Environment * env, struct ModlObject key, struct ModlObject value)
+{
+  vm_environment_store(env, vm_nametable_define(self, env->nametable, key), value);
+  modl_object_release_tmp(key);
+}
+
 /*!
  * \brief Add external function to VM
  * \param self Virutal machine instance
- * \param ef Function pointer, returning ModlObject*
+ * \param ef Function pointer, returning ModlObject
+ * \param arity Number of arguments
  * \return Identifier of the function
  */
-uint64_t vm_add_external_function(struct VMState * self, struct ModlObject (*ef) (struct VMState *))
+uint64_t vm_add_external_function(
+  struct VMState * self,
+  struct ModlObject (*ef) (struct VMState *, uint32_t, struct ModlObject const *),
+  uint32_t arity
+)
 {
   if (NULL == self)
   {
@@ -105,7 +375,7 @@ uint64_t vm_add_external_function(struct VMState * self, struct ModlObject (*ef)
     exit(EXIT_FAILURE);
   }
 
-  self->external_functions[self->efc] = ef;
+  self->external_functions[self->efc] = (struct ExternalFunction) { ef, arity };
   return self->efc++;
 }
 
@@ -113,9 +383,9 @@ uint64_t vm_add_external_function(struct VMState * self, struct ModlObject (*ef)
  * \brief Get external function by id
  * \param self Virtual machine instance
  * \param id Identifier
- * \return Function pointer, returning ModlObject*
+ * \return External function entry
  */
-struct ModlObject (* vm_get_external_function(struct VMState const * const self, uint64_t id)) (struct VMState *)
+struct ExternalFunction const * vm_get_external_function(struct VMState const * const self, uint64_t id)
 {
   if (id >= self->efc)
   {
@@ -127,19 +397,22 @@ struct ModlObject (* vm_get_external_function(struct VMState const * const self,
     exit(EXIT_FAILURE);
   }
 
-  return self->external_functions[id];
+  return &self->external_functions[id];
 }
 
 /*!
  * \brief Get external function by function pointer
  * \param self Virutal machine instance
- * \param f Function pointer, returning ModlObject*
+ * \param f Function pointer, returning ModlObject
  * \return External function as ModlObject*
  */
-struct ModlObject vm_find_external_function(struct VMState const * const self, struct ModlObject (*f) (struct VMState *))
+struct ModlObject vm_find_external_function(
+  struct VMState const * const self,
+  struct ModlObject (*f) (struct VMState *, uint32_t, struct ModlObject const *)
+)
 {
   uint64_t id = 0;
-  while (id < self->efc && self->external_functions[id] != f) ++id;
+  while (id < self->efc && self->external_functions[id].function != f) ++id;
 
   if (id >= self->efc)
   {
@@ -153,25 +426,72 @@ struct ModlObject vm_find_external_function(struct VMState const * const self, s
   return efun_to_modl(id);
 }
 
-static struct Sebo *decoded_sebo_table;
+struct ConstantPool
+{
+  struct ModlObject * objects;
+  uint32_t count, capacity;
+
+  struct ModlMap lookup;
+};
+
+/* floats that compare equal may still differ, as 0.0 and -0.0 do */
+static inline bool constant_pool_same(struct ModlObject a, struct ModlObject b)
+{
+  if (ModlTypeFloating != modl_object_type(a)) return TRUE;
+
+  double const x = modl_to_double(a), y = modl_to_double(b);
+  return 0 == memcmp(&x, &y, sizeof (double));
+}
+
+/*!
+ *  \brief Add constant to the pool
+ *  \param pool Constant pool
+ *  \param object Decoded constant
+ *  \return Index of the constant; equal constants share one entry
+ */
+static uint32_t constant_pool_add(struct ConstantPool * pool, struct ModlObject object)
+{
+  struct ModlObject const * known = modl_map_get(&pool->lookup, object);
+  bool const same = NULL != known && constant_pool_same(object, pool->objects[modl_to_int(*known)]);
+  if (same)
+  {
+    modl_object_release_tmp(object);
+    return (uint32_t) modl_to_int(*known);
+  }
+
+  if (pool->count + 1 > pool->capacity)
+  {
+    pool->capacity = pool->capacity ? 2 * pool->capacity : 16;
+    pool->objects = realloc(pool->objects, pool->capacity * sizeof (struct ModlObject));
+  }
+
+  pool->objects[pool->count] = modl_object_take(object);
+  if (ModlTypeTable != modl_object_type(object) && NULL == known)
+    modl_map_set(&pool->lookup, object, int_to_modl(pool->count));
+
+  return pool->count++;
+}
 
 /*!
- *  \brief Decode instruction
+ *  \brief Decode single instruction
+ *  \param code Raw bytecode
+ *  \param ip Offset of the instruction in bytecode
+ *  \param pool Constant pool receiving TP_SEBO operands
+ *  \param instruction Decoded instruction
+ *  \return Byte length of the instruction
  */
-static struct Instruction decode_instruction(struct VMState * state)
+static size_t decode_instruction(byte * code, size_t ip, struct ConstantPool * pool, struct Instruction * instruction)
 {
-  enum ModlOpcode opcode = state->code[state->ip];
-  struct Instruction instruction = { .opcode = opcode };
+  enum ModlOpcode opcode = code[ip];
+  *instruction = (struct Instruction) { .opcode = opcode, .offset = (uint32_t) ip };
   struct InstructionParametersTemplate template = instruction_parameters_templates[opcode];
-  #ifndef VM_FAST
   if (TP_ERROR == template.p[0])
   {
     char const * name = instructions_names_table[opcode];
     if (NULL == name) name = "#???#";
-    printf("\x1b[31;1mfailed to decode instruction: %s\x1b[0m\n", name);
+    printf("\x1b[31;1mfailed to decode instruction: %s\x1b[0m[%04lx]\n", name, ip);
     exit(EXIT_FAILURE);
   }
-  #endif
 
   size_t offset = 1;
   for (byte i = 0; i < INSTRUCTION_TEMPLATE_VALUES_COUNT; ++i)
@@ -182,64 +502,180 @@ static struct Instruction decode_instruction(struct VMState * state)
 
       case TP_REGAL:
       {
-        instruction.a[i].r[0] = state->code[state->ip + offset] & 0xF;
+        instruction->a[i].r[0] = code[ip + offset] & 0xF;
         offset += 1;
       } break;
 
       case TP_REGSP:
       {
-        instruction.a[i].r[0] = (state->code[state->ip + offset] >> 4) & 0xF;
-        instruction.a[i].r[1] = (state->code[state->ip + offset] >> 0) & 0xF;
+        instruction->a[i].r[0] = (code[ip + offset] >> 4) & 0xF;
+        instruction->a[i].r[1] = (code[ip + offset] >> 0) & 0xF;
         offset += 1;
       } break;
 
       case TP_INT64:
       {
-        instruction.a[i].i64 = ((int64_t) 0)
-          | (((int64_t) state->code[state->ip + offset + 0]) << 8*7)
-          | (((int64_t) state->code[state->ip + offset + 1]) << 8*6)
-          | (((int64_t) state->code[state->ip + offset + 2]) << 8*5)
-          | (((int64_t) state->code[state->ip + offset + 3]) << 8*4)
-          | (((int64_t) state->code[state->ip + offset + 4]) << 8*3)
-          | (((int64_t) state->code[state->ip + offset + 5]) << 8*2)
-          | (((int64_t) state->code[state->ip + offset + 6]) << 8*1)
-          | (((int64_t) state->code[state->ip + offset + 7]) << 8*0);
+        instruction->a[i].i64 = (int64_t) (((uint64_t) 0)
+          | (((uint64_t) code[ip + offset + 0]) << 8*7)
+          | (((uint64_t) code[ip + offset + 1]) << 8*6)
+          | (((uint64_t) code[ip + offset + 2]) << 8*5)
+          | (((uint64_t) code[ip + offset + 3]) << 8*4)
+          | (((uint64_t) code[ip + offset + 4]) << 8*3)
+          | (((uint64_t) code[ip + offset + 5]) << 8*2)
+          | (((uint64_t) code[ip + offset + 6]) << 8*1)
+          | (((uint64_t) code[ip + offset + 7]) << 8*0));
         offset += 8;
       } break;
 
       case TP_SEBO:
       {
-        if (ModlTypeNil != decoded_sebo_table[state->ip + offset].object.type)
-        {
-          instruction.a[i].object = decoded_sebo_table[state->ip + offset].object;
-          offset += decoded_sebo_table[state->ip + offset].byte_length;
-          instruction.byte_length = offset;
-          return instruction;
-        }
-
-        struct Sebo data = modl_decode_sebo(&state->code[state->ip] + offset);
-        if (data.object.type != ModlTypeTable)
-        {
-          // memcpy(&decoded_sebo_table[state->ip + offset], &data, sizeof (struct Sebo));
-          decoded_sebo_table[state->ip + offset] = data;
-          modl_object_take(data.object);
-        }
-
-        instruction.a[i].object = data.object;
+        /* tables are kept as templates, OP_LOADC makes a fresh one on each execution */
+        struct Sebo data = modl_decode_sebo(&code[ip] + offset);
+        instruction->a[i].constant = constant_pool_add(pool, data.object);
         offset += data.byte_length;
       } break;
     }
   }
 
-  instruction.byte_length = offset;
-  return instruction;
+  if (OP_CALLW == opcode && instruction->a[0].r[1] + instruction->a[1].r[0] > VM_SETTING_REGITERS_COUNT)
+  {
+    printf("\x1b[31;1mfailed to decode instruction: %s\x1b[0m[%04lx]: %s\n", "CALLW", ip, "arguments exceed registers");
+    exit(EXIT_FAILURE);
+  }
+
+  if (OP_TBLNEXT == opcode && instruction->a[0].r[1] + 3 > VM_SETTING_REGITERS_COUNT)
+  {
+    printf("\x1b[31;1mfailed to decode instruction: %s\x1b[0m[%04lx]: %s\n", "TBLNEXT", ip, "key and value exceed registers");
+    exit(EXIT_FAILURE);
+  }
+
+  return offset;
+}
+
+/*!
+ *  \brief Translate bytecode into pre-decoded instruction stream
+ *  \param code Raw bytecode
+ *  \param length Bytecode length
+ *  \param count Number of decoded instructions
+ *  \param pool Constant pool referenced by TP_SEBO operands
+ *  \return Decoded instructions; code addresses are resolved to indices
+ */
+static struct Instruction * translate_bytecode(byte * code, size_t length, size_t * count, struct ConstantPool * pool)
+{
+  *pool = (struct ConstantPool) { NULL, 0, 0 };
+  modl_map_init(&pool->lookup, 8);
+
+  size_t capacity = 64, n = 0, ip = 0;
+  struct Instruction * instructions = malloc(capacity * sizeof (struct Instruction));
+  size_t * index_of = malloc((length + 1) * sizeof (size_t));
+  for (size_t i = 0; i <= length; ++i) index_of[i] = SIZE_MAX;
+
+  while (ip < length)
+  {
+    if (n + 1 >= capacity)
+    {
+      capacity *= 2;
+      instructions = realloc(instructions, capacity * sizeof (struct Instruction));
+    }
+
+    index_of[ip] = n;
+    ip += decode_instruction(code, ip, pool, &instructions[n++]);
+  }
+
+  /* code behind the last instruction is filled with OP_RET */
+  instructions[n] = (struct Instruction) { .opcode = OP_RET, .offset = (uint32_t) ip };
+  size_t const end = n++;
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    struct InstructionParametersTemplate template = instruction_parameters_templates[instructions[i].opcode];
+    for (byte k = 0; k < INSTRUCTION_TEMPLATE_VALUES_COUNT; ++k)
+    {
+      if (TP_INT64 != template.p[k]) continue;
+
+      int64_t const target = (int64_t) instructions[i].offset + instructions[i].a[k].i64;
+      if (target >= (int64_t) length)
+      {
+        instructions[i].a[k].i64 = (int64_t) end;
+      }
+      else if (target < 0 || SIZE_MAX == index_of[target])
+      {
+        printf(
+          "\x1b[31;1m  %s: %" PRId64 "\x1b[0m[%04x]\n",
+          "  invalid code address", target,
+          instructions[i].offset
+        );
+        exit(EXIT_FAILURE);
+      }
+      else
+      {
+        instructions[i].a[k].i64 = (int64_t) index_of[target];
+      }
+    }
+  }
+
+  free(index_of);
+  modl_map_dispose(&pool->lookup);
+
+  *count = n;
+  return realloc(instructions, n * sizeof (struct Instruction));
+}
+
+/*!
+ *  \brief Assign inline cache entries to instructions that use them
+ *  \param code Decoded instructions
+ *  \param count Number of decoded instructions
+ *  \param table_caches Set to the number of table cache entries
+ *  \return Number of environment cache entries
+ */
+static uint32_t assign_inline_caches(struct Instruction * code, size_t count, uint32_t * table_caches)
+{
+  uint32_t caches = 0;
+  *table_caches = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    switch (code[i].opcode)
+    {
+      case OP_ENVGETC:
+      case OP_ENVSETC:
+      case OP_ENVARGC: code[i].a[1].cache = caches++; break;
+      case OP_TBLGETR:
+      case OP_TBLSETR: code[i].a[1].cache = (*table_caches)++; break;
+      default: break;
+    }
+  }
+  return caches;
+}
+
+/*!
+ *  \brief Point the table cache at a key of a shape
+ *  \param cache Table cache
+ *  \param shape Shape of the table, NULL to empty the cache
+ *  \param target Shape the key moved the table to, NULL if it was there
+ *  \param key Key
+ *  \param slot Slot of the key in the shape it is in
+ */
+static void vm_table_cache_set(struct TableCache * cache, struct ModlShape * shape, struct ModlShape * target, struct ModlObject key, uint32_t slot)
+{
+  if (NULL != shape) modl_shape_take(shape);
+  if (NULL != target) modl_shape_take(target);
+  modl_object_take(key);
+
+  if (NULL != cache->shape) modl_shape_release(cache->shape);
+  if (NULL != cache->target) modl_shape_release(cache->target);
+  modl_object_release(cache->key);
+
+  cache->shape = shape;
+  cache->target = target;
+  cache->key = key;
+  cache->slot = slot;
 }
 
 #ifndef VM_FAST
-static void instruction_display(struct VMState * vm, struct Instruction instruction)
+static void instruction_display(struct VMState * vm, struct Instruction const * instruction)
 {
-  printf("\x1b[36m%-8s\x1b[0m", instructions_names_table[instruction.opcode]);
-  struct InstructionParametersTemplate template = instruction_parameters_templates[instruction.opcode];
+  printf("\x1b[36m%-8s\x1b[0m", instructions_names_table[instruction->opcode]);
+  struct InstructionParametersTemplate template = instruction_parameters_templates[instruction->opcode];
 
   if (template.p[0] != TP_EMPTY)
     printf("%c", ' ');
@@ -250,26 +686,26 @@ static void instruction_display(struct VMState * vm, struct Instruction instruct
     switch (template.p[i])
     {
       case TP_REGAL:
-        printf("\x1b[37;1mR%d\x1b[0m", instruction.a[i].r[0]);
+        printf("\x1b[37;1mR%d\x1b[0m", instruction->a[i].r[0]);
         printf("%c", '{');
-        modl_object_display(&vm->registers[instruction.a[i].r[0]]);
+        modl_object_display(&vm->registers[instruction->a[i].r[0]]);
         printf("%c", '}');
         break;
       case TP_REGSP:
-        printf("\x1b[37;1mR%d\x1b[0m", instruction.a[i].r[0]);
+        printf("\x1b[37;1mR%d\x1b[0m", instruction->a[i].r[0]);
         printf("%c", '{');
-        modl_object_display(&vm->registers[instruction.a[i].r[0]]);
+        modl_object_display(&vm->registers[instruction->a[i].r[0]]);
         printf("%c", '}');
-        printf(", \x1b[37;1mR%d\x1b[0m", instruction.a[i].r[1]);
+        printf(", \x1b[37;1mR%d\x1b[0m", instruction->a[i].r[1]);
         printf("%c", '{');
-        modl_object_display(&vm->registers[instruction.a[i].r[1]]);
+        modl_object_display(&vm->registers[instruction->a[i].r[1]]);
         printf("%c", '}');
         break;
       case TP_INT64:
-        printf("[%" PRId64 "]", instruction.a[i].i64);
+        printf("[%04x]", vm->code[instruction->a[i].i64].offset);
         break;
       case TP_SEBO:
-        modl_object_display(&instruction.a[i].object);
+        modl_object_display(&vm->constants[instruction->a[i].constant]);
         break;
 
       case TP_ERROR: case TP_EMPTY: /* unreachable */ break;
@@ -280,21 +716,6 @@ static void instruction_display(struct VMState * vm, struct Instruction instruct
 }
 #endif
 
-inline void instruction_release(struct Instruction instruction)
-{
-  struct InstructionParametersTemplate template = instruction_parameters_templates[instruction.opcode];
-  for (byte i = 0; i < INSTRUCTION_TEMPLATE_VALUES_COUNT; ++i)
-  {
-    switch (template.p[i])
-    {
-      case TP_SEBO:
-        // printf("%s\n", "  releasing instruction's temporary object");
-        modl_object_release_tmp(instruction.a[i].object);
-      default: break;
-    }
-  }
-}
-
 
 inline struct ModlObject vm_reg_read(struct VMState * state, byte r)
 {
@@ -319,7 +740,7 @@ static inline void vm_reg_write(struct VMState * state, byte r, struct ModlObjec
     }
 
     state->ram.read_after_rewrite[r] = FALSE;
-    state->ram.last_write_points[r] = state->ip;
+    state->ram.last_write_points[r] = state->code[state->ip].offset;
   }
   #endif
 
@@ -361,15 +782,53 @@ static inline void vm_reg_write_i(struct VMState * const state, byte r, int64_t
 }
 
 
-struct ModlObject run(struct VMState * state);
-struct ModlObject vm_call_function(struct VMState * state, struct ModlObject obj)
+/*!
+ *  \brief Copy call arguments to the stack window of a new frame
+ *  \param state Virtual machine instance
+ *  \param argc Number of arguments
+ *  \param argv Arguments
+ *  \return Start of the window
+ */
+static inline size_t vm_push_arguments(struct VMState * state, uint32_t argc, struct ModlObject const * argv)
 {
-  if (ModlTypeFunction != obj.type)
+  if (state->sp + argc > state->max_count_stack)
   {
-    printf("\x1b[31;1m  Object of type %s is not callable\x1b[0m\n", modl_types_names_table[obj.type]);
+    printf(
+      "\x1b[31;1m%s: stack_max_size=%lu\x1b[0m\n",
+      "  maximum stack size exceeded",
+      state->max_count_stack
+    );
     exit(EXIT_FAILURE);
   }
 
+  size_t const arguments = state->sp;
+  for (uint32_t i = 0; i < argc; ++i)
+    state->stack[state->sp++] = modl_object_take(argv[i]);
+  return arguments;
+}
+
+/*!
+ *  \brief Release stack window of frame entered with arguments
+ *  \param state Virtual machine instance
+ *  \param frame Call frame
+ */
+static inline void vm_release_arguments(struct VMState * state, struct CallFrame const * frame)
+{
+  if (0 == frame->argc) return;
+
+  while (state->sp > frame->arguments)
+    modl_object_release(state->stack[--state->sp]);
+}
+
+/*!
+ *  \brief Push call frame of modl function and jump to its entry point
+ *  \param state Virtual machine instance
+ *  \param obj Function, not external
+ *  \param argc Number of arguments
+ *  \param argv Arguments, copied to the frame
+ */
+static inline void vm_push_call_frame(struct VMState * state, struct ModlObject obj, uint32_t argc, struct ModlObject const * argv)
+{
   if (state->csp + 1 >= state->max_count_call_stack)
   {
     printf(
@@ -380,461 +839,1078 @@ struct ModlObject vm_call_function(struct VMState * state, struct ModlObject obj
     exit(EXIT_FAILURE);
   }
 
-  struct ModlObject ret;
-
-  #ifndef VM_FAST
-  struct Environment * env = calloc(1, sizeof (struct Environment));
-  env->parent = obj.value.ref->value.fun.context;
-  env->vartable = modl_table_new();
+  struct Environment * env = vm_environment_acquire(
+    state, modl_to_ref(obj)->value.fun.context, vm_get_nametable(state, modl_to_ref(obj)->value.fun.position)
+  );
   state->call_stack[++state->csp] = (struct CallFrame) {
     .return_address = state->ip,
     .environment = env,
+    .arguments = vm_push_arguments(state, argc, argv),
+    .argc = argc,
   };
+  state->ip = modl_to_ref(obj)->value.fun.position;
+}
 
-  if (obj.value.ref->value.fun.is_external)
+/*!
+ *  \brief Replace current call frame by the frame of modl function
+ *
+ *  Used for calls followed by OP_RET. The environment of the current
+ *  frame is reused unless a function was created in it: the callee or
+ *  one of its arguments may then still refer to it, and a new frame is
+ *  pushed as for a regular call. Parents of environments are contexts of
+ *  functions, so every environment a function can reach is captured.
+ *
+ *  \param state Virtual machine instance
+ *  \param obj Function, not external
+ *  \param argc Number of arguments
+ *  \param argv Arguments in registers, copied to the frame
+ */
+static inline void vm_replace_call_frame(struct VMState * state, struct ModlObject obj, uint32_t argc, struct ModlObject const * argv)
+{
+  struct CallFrame * frame = &state->call_stack[state->csp];
+  struct Environment * env = frame->environment;
+  struct Environment * context = modl_to_ref(obj)->value.fun.context;
+  uint64_t const position = modl_to_ref(obj)->value.fun.position;
+
+  if (env->captured)
   {
-    ret = vm_get_external_function(state, obj.value.ref->value.fun.position)(state);
-    vm_reg_write(state, REG(0), ret);
+    vm_push_call_frame(state, obj, argc, argv);
+    return;
   }
-  else
+
+  /* functions kept past the call that created them still refer to its
+     environment */
+  for (struct Environment const * e = context; NULL != e; e = e->parent)
   {
-    state->ip = obj.value.ref->value.fun.position;
-    ret = run(state);
+    if (e == env)
+    {
+      vm_push_call_frame(state, obj, argc, argv);
+      return;
+    }
   }
 
-  modl_object_release(env->vartable);
-  free(env);
-  state->ip = state->call_stack[state->csp].return_address;
-  state->csp -= 1;
-  modl_object_release_tmp(obj);
-  #else
-      if (obj.value.ref->value.fun.is_external)
-      {
-        ret = vm_get_external_function(state, obj.value.ref->value.fun.position)(state);
-        vm_reg_write(state, REG(0), ret);
-        modl_object_release_tmp(obj);
-        return ret;
-      }
+  /* obj may be owned by a variable of the released environment */
+  vm_environment_release(env);
+  vm_environment_enter(state, env, context, vm_get_nametable(state, position));
 
-      struct Environment * env = calloc(1, sizeof (struct Environment));
-      env->parent = obj.value.ref->value.fun.context;
-      env->vartable = modl_table_new();
-      state->call_stack[++state->csp] = (struct CallFrame) {
-        .return_address = state->ip,
-        .environment = env,
-      };
-
-      state->ip = obj.value.ref->value.fun.position;
-      ret = run(state);
-      modl_object_release(env->vartable);
-      free(env);
-      state->ip = state->call_stack[state->csp].return_address;
-      state->csp -= 1;
-      modl_object_release_tmp(obj);
-  #endif
+  vm_release_arguments(state, frame);
+  frame->arguments = vm_push_arguments(state, argc, argv);
+  frame->argc = argc;
 
-  return ret;
+  state->ip = position;
+  state->tail_calls += 1;
 }
 
+/*!
+ *  \brief Pop call frame and restore address of the call instruction
+ *  \param state Virtual machine instance
+ */
+static inline void vm_pop_call_frame(struct VMState * state)
+{
+  struct CallFrame const * frame = &state->call_stack[state->csp];
+  vm_release_arguments(state, frame);
+  vm_environment_release(frame->environment);
+  state->ip = frame->return_address;
+  state->csp -= 1;
+}
 
-static struct ModlObject modl_std_concat_strings(struct VMState * vm);
-struct ModlObject run(struct VMState * state)
+/*!
+ *  \brief Run deferred memory work between two instructions
+ *
+ *  Disposes of queued tables within the step budget and collects cycles
+ *  once enough candidates are buffered. Only called where no table is
+ *  held by a temporary.
+ *
+ *  \param state Virtual machine instance
+ */
+static inline void vm_safepoint(struct VMState * state)
+{
+  if (VM_RELEASE_QUEUE_SIZE > 0)
+    modl_object_release_pending(VM_SETTING_RELEASE_BUDGET);
+  if (VM_SETTING_CYCLE_CANDIDATES > 0 && modl_collector_candidates() >= VM_SETTING_CYCLE_CANDIDATES)
+    modl_collector_collect();
+}
+
+/*!
+ *  \brief End region of returning call frame
+ *
+ *  Registers other than REG(0) holding objects of the region are
+ *  temporaries of the returning call and are cleared; values callers keep
+ *  in registers, even from regions of their own, are left alone. The
+ *  result is promoted when REG(0) holds its only reference. Values stored
+ *  in tables of other regions were promoted by vm_region_escape, and names
+ *  are only bound in the environment of the call, which is released by
+ *  now. Values that still have several references when they escape, and
+ *  values natives store, keep the region alive until they are released.
+ *
+ *  \param state Virtual machine instance
+ *  \param region Region of the frame
+ */
+static void vm_region_end(struct VMState * state, struct ModlRegion * region)
 {
-  while (TRUE)
+  for (byte i = 1; i < VM_SETTING_REGITERS_COUNT; ++i)
   {
-    if (not VM_SETTING_SILENT)
+    struct ModlObject obj = state->registers[i];
+    if (not modl_object_is_value_type(obj) && region == modl_pool_region_of(modl_to_ref(obj)))
     {
-      // printf("%s", "Registers: [ ");
-      // for (size_t i = 0; i < VM_SETTING_REGITERS_COUNT; ++i)
-      // {
-      //   modl_object_display(state->registers[i]);
-      //   printf("%c", ' ');
-      // }
-      // printf("%c\n", ']');
-      //
-      // printf("Stack(%lu): [ ", state->sp);
-      // for (size_t i = 0; i < state->sp; ++i)
-      // {
-      //   modl_object_display(state->stack[i]);
-      //   printf("%c", ' ');
-      // }
-      // printf("%c\n", ']');
-      //
-      // printf("%s", "Environment:");
-      // struct Environment * env = state->call_stack[state->csp].environment;
-      // while (NULL != env)
-      // {
-      //   printf("%c", ' ');
-      //   modl_object_display(env->vartable);
-      //   env = env->parent;
-      // }
-      // printf("%c", '\n');
+      state->registers[i] = modl_nil();
+      modl_object_release(obj);
     }
+  }
 
-    
+  /* the end of the outermost region is a natural idle point, nested ones
+     may end in every iteration of a loop */
+  modl_object_release_pending(modl_pool_region_is_nested(region) ? VM_SETTING_RELEASE_BUDGET : SIZE_MAX);
+
+  modl_pool_region_leave(region);
+  struct ModlObject const result = state->registers[REG(0)];
+  state->registers[REG(0)] = modl_object_promote(result);
+  if (not modl_object_is_value_type(result) && modl_to_ref(result) != modl_to_ref(state->registers[REG(0)]))
+    state->region_promotions += 1;
+  modl_pool_region_end(region);
+}
+
+/*!
+ *  \brief Promote value of a register before a table of another region keeps it
+ *
+ *  The value can be moved only while the register holds its only
+ *  reference, so it is done before the table takes one.
+ *
+ *  \param state Virtual machine instance
+ *  \param r Register holding the value
+ *  \param table Table the value is stored in
+ *  \return Value to store
+ */
+static inline struct ModlObject vm_region_escape(struct VMState * state, byte r, struct ModlObject table)
+{
+  struct ModlObject const obj = vm_reg_read(state, r);
+  if (modl_object_is_value_type(obj) || modl_object_is_value_type(table)) return obj;
+
+  struct ModlRegion * const region = modl_pool_region_of(modl_to_ref(obj));
+  if (NULL == region || region == modl_pool_region_of(modl_to_ref(table))) return obj;
+
+  state->registers[r] = modl_object_promote(obj);
+  if (modl_to_ref(obj) != modl_to_ref(state->registers[r]))
+    state->region_promotions += 1;
+  return state->registers[r];
+}
+
+struct ModlObject run(struct VMState * state);
+
+/*!
+ *  \brief Call function and wait for its result
+ *
+ *  Used for natives and by natives calling back into modl code; OP_CALLR
+ *  and OP_CALLW enter modl functions without nesting run().
+ *
+ *  \param state Virtual machine instance
+ *  \param obj Function
+ *  \param argc Number of arguments
+ *  \param argv Arguments, borrowed
+ *  \return Result of the call, also stored in REG(0)
+ */
+struct ModlObject vm_call_function(struct VMState * state, struct ModlObject obj, uint32_t argc, struct ModlObject const * argv)
+{
+  if (ModlTypeFunction != modl_object_type(obj))
+  {
+    printf("\x1b[31;1m  Object of type %s is not callable\x1b[0m\n", modl_types_names_table[modl_object_type(obj)]);
+    exit(EXIT_FAILURE);
+  }
+
+  struct ModlObject ret;
+
+  if (modl_to_ref(obj)->value.fun.is_external)
+  {
     #ifndef VM_FAST
-    if (not VM_SETTING_SILENT) printf("[%04lx] ", state->ip);
+    if (state->csp + 1 >= state->max_count_call_stack)
+    {
+      printf(
+        "\x1b[31;1m  %s: call_stack_max_size=%lu\x1b[0m\n",
+        "  maximum call stack size exceeded",
+        state->max_count_call_stack
+      );
+      exit(EXIT_FAILURE);
+    }
+
+    state->call_stack[++state->csp] = (struct CallFrame) {
+      .return_address = state->ip,
+      .environment = vm_environment_acquire(state, modl_to_ref(obj)->value.fun.context, modl_nil()),
+      .arguments = state->sp,
+    };
     #endif
 
-    struct Instruction instruction = decode_instruction(state);
+    ret = vm_get_external_function(state, modl_to_ref(obj)->value.fun.position)->function(state, argc, argv);
+    vm_reg_write(state, REG(0), ret);
 
     #ifndef VM_FAST
-    if (not VM_SETTING_SILENT) instruction_display(state, instruction);
+    vm_pop_call_frame(state);
     #endif
+  }
+  else
+  {
+    vm_push_call_frame(state, obj, argc, argv);
+    ret = run(state);
+    vm_pop_call_frame(state);
+  }
 
-    switch (instruction.opcode)
-    {
-      case OP_NOP: break;
+  modl_object_release_tmp(obj);
+  return ret;
+}
+
+/*!
+ *  \brief Call native with arguments passed through the stack by OP_PUSH
+ *  \param state Virtual machine instance
+ *  \param obj External function
+ */
+static void vm_call_external_function_from_stack(struct VMState * state, struct ModlObject obj)
+{
+  uint32_t const arity = vm_get_external_function(state, modl_to_ref(obj)->value.fun.position)->arity;
+  if (state->sp < arity)
+  {
+    printf("\x1b[31;1m  Cannot pop from empty stack\x1b[0m\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* first argument is pushed last */
+  struct ModlObject argv[arity + 1];
+  for (uint32_t i = 0; i < arity; ++i)
+    argv[i] = state->stack[--state->sp];
+
+  vm_call_function(state, obj, arity, argv);
+
+  for (uint32_t i = 0; i < arity; ++i)
+    modl_object_release(argv[i]);
+}
+
+
+/*!
+ *  \brief Select quickened variant of arithmetic or comparison instruction
+ *  \param opcode Generic opcode
+ *  \param left Type of the left operand
+ *  \param right Type of the right operand
+ *  \return Quickened opcode or OP_NOP if there is none for these operands
+ */
+static enum ModlOpcode vm_quickened_opcode(enum ModlOpcode opcode, enum ModlType left, enum ModlType right)
+{
+  static enum ModlOpcode const integer_variants[256] =
+  {
+    [OP_ADD] = OP_ADD_II,
+    [OP_SUB] = OP_SUB_II,
+    [OP_MUL] = OP_MUL_II,
+    [OP_CMPLT] = OP_CMPLT_II,
+    [OP_CMPNLT] = OP_CMPNLT_II,
+    [OP_CMPGT] = OP_CMPGT_II,
+    [OP_CMPNGT] = OP_CMPNGT_II,
+    [OP_CMPLE] = OP_CMPLE_II,
+    [OP_CMPGE] = OP_CMPGE_II,
+  };
+
+  static enum ModlOpcode const floating_variants[256] =
+  {
+    [OP_ADD] = OP_ADD_FF,
+    [OP_SUB] = OP_SUB_FF,
+    [OP_MUL] = OP_MUL_FF,
+    [OP_DIV] = OP_DIV_FF,
+    [OP_CMPLT] = OP_CMPLT_FF,
+    [OP_CMPGT] = OP_CMPGT_FF,
+    [OP_CMPLE] = OP_CMPLE_FF,
+    [OP_CMPGE] = OP_CMPGE_FF,
+  };
+
+  if (left != right) return OP_NOP;
+
+  switch (left)
+  {
+    case ModlTypeInteger: return integer_variants[opcode];
+    case ModlTypeFloating: return floating_variants[opcode];
+    case ModlTypeString: return OP_ADD == opcode ? OP_ADD_SS : OP_NOP;
+    default: return OP_NOP;
+  }
+}
 
-      case OP_RET:
+
+#ifndef VM_FAST
+static void __attribute__ ((__noinline__, __cold__)) vm_trace_instruction(struct VMState * state, struct Instruction const * instruction)
+{
+  // printf("%s", "Registers: [ ");
+  // for (size_t i = 0; i < VM_SETTING_REGITERS_COUNT; ++i)
+  // {
+  //   modl_object_display(state->registers[i]);
+  //   printf("%c", ' ');
+  // }
+  // printf("%c\n", ']');
+  //
+  // printf("Stack(%lu): [ ", state->sp);
+  // for (size_t i = 0; i < state->sp; ++i)
+  // {
+  //   modl_object_display(state->stack[i]);
+  //   printf("%c", ' ');
+  // }
+  // printf("%c\n", ']');
+  //
+  // printf("%s", "Environment:");
+  // struct Environment * env = state->call_stack[state->csp].environment;
+  // while (NULL != env)
+  // {
+  //   printf("%c", ' ');
+  //   modl_object_display(env->vartable);
+  //   env = env->parent;
+  // }
+  // printf("%c", '\n');
+
+  printf("[%04x] ", instruction->offset);
+  instruction_display(state, instruction);
+}
+#endif
+
+static inline struct Instruction * vm_fetch_instruction(struct VMState * state)
+{
+  struct Instruction * const instruction = &state->code[state->ip];
+
+  #ifndef VM_FAST
+  if (not VM_SETTING_SILENT) vm_trace_instruction(state, instruction);
+  #endif
+
+  return instruction;
+}
+
+/*
+ *  Every handler ends with VM_NEXT() or VM_DISPATCH(). With threaded dispatch
+ *  these expand to an indirect jump through dispatch_table, so each handler
+ *  has its own branch to the next one; otherwise they jump back to the switch.
+ */
+#ifdef VM_THREADED_DISPATCH
+#define VM_CASE(OP) case OP: vm_label_##OP
+#define VM_CASE_DEFAULT() default: vm_label_default
+#define VM_GOTO_CASE(OP) goto vm_label_##OP
+#define VM_DISPATCH() do { instruction = vm_fetch_instruction(state); goto *dispatch_table[instruction->opcode]; } while (0)
+#else
+#define VM_CASE(OP) case OP
+#define VM_CASE_DEFAULT() default
+/* the switch reads the opcode of the current instruction */
+#define VM_GOTO_CASE(OP) goto vm_switch
+#define VM_DISPATCH() goto vm_dispatch
+#endif
+#define VM_NEXT() do { state->ip += 1; VM_DISPATCH(); } while (0)
+
+static struct ModlObject modl_std_concat_strings(struct VMState * vm, uint32_t argc, struct ModlObject const * argv);
+
+/*!
+ *  \brief Execute instructions until the current call frame returns
+ *  \param state Virtual machine instance
+ *  \return Value of REG(0) at return
+ */
+struct ModlObject run(struct VMState * state)
+{
+  /* modl calls push frames inside this loop, return from run() only when
+     the frame this run() was started in returns */
+  size_t const base_csp = state->csp;
+
+  #ifdef VM_THREADED_DISPATCH
+  static void const * const dispatch_table[256] =
+  {
+    [0 ... 255] = &&vm_label_default,
+    [OP_NOP] = &&vm_label_OP_NOP,
+    [OP_RET] = &&vm_label_OP_RET,
+    [OP_MOV] = &&vm_label_OP_MOV,
+    [OP_LOADC] = &&vm_label_OP_LOADC,
+    [OP_TBLGETR] = &&vm_label_OP_TBLGETR,
+    [OP_CALLR] = &&vm_label_OP_CALLR,
+    [OP_CALLW] = &&vm_label_OP_CALLW,
+    [OP_TBLITER] = &&vm_label_OP_TBLITER,
+    [OP_TBLNEXT] = &&vm_label_OP_TBLNEXT,
+    [OP_REGION] = &&vm_label_OP_REGION,
+    [OP_LOADFUN] = &&vm_label_OP_LOADFUN,
+    [OP_JMP] = &&vm_label_OP_JMP,
+    [OP_ROL] = &&vm_label_OP_ROL,
+    [OP_ROR] = &&vm_label_OP_ROR,
+    [OP_IDIV] = &&vm_label_OP_IDIV,
+    [OP_ADD] = &&vm_label_OP_ADD,
+    [OP_SUB] = &&vm_label_OP_SUB,
+    [OP_MUL] = &&vm_label_OP_MUL,
+    [OP_DIV] = &&vm_label_OP_DIV,
+    [OP_MOD] = &&vm_label_OP_MOD,
+    [OP_AND] = &&vm_label_OP_AND,
+    [OP_OR] = &&vm_label_OP_OR,
+    [OP_XOR] = &&vm_label_OP_XOR,
+    [OP_NAND] = &&vm_label_OP_NAND,
+    [OP_NOR] = &&vm_label_OP_NOR,
+    [OP_NXOR] = &&vm_label_OP_NXOR,
+    [OP_CMPLT] = &&vm_label_OP_CMPLT,
+    [OP_CMPNLT] = &&vm_label_OP_CMPNLT,
+    [OP_CMPGT] = &&vm_label_OP_CMPGT,
+    [OP_CMPNGT] = &&vm_label_OP_CMPNGT,
+    [OP_CMPLE] = &&vm_label_OP_CMPLE,
+    [OP_CMPNLE] = &&vm_label_OP_CMPNLE,
+    [OP_CMPGE] = &&vm_label_OP_CMPGE,
+    [OP_CMPNGE] = &&vm_label_OP_CMPNGE,
+    [OP_CMPEQ] = &&vm_label_OP_CMPEQ,
+    [OP_CMPNEQ] = &&vm_label_OP_CMPNEQ,
+    [OP_JCF] = &&vm_label_OP_JCF,
+    [OP_JCT] = &&vm_label_OP_JCT,
+    [OP_POP] = &&vm_label_OP_POP,
+    [OP_PUSH] = &&vm_label_OP_PUSH,
+    [OP_TBLPUSH] = &&vm_label_OP_TBLPUSH,
+    [OP_TBLSETR] = &&vm_label_OP_TBLSETR,
+    [OP_TBLDELR] = &&vm_label_OP_TBLDELR,
+    [OP_ENVGETC] = &&vm_label_OP_ENVGETC,
+    [OP_ENVSETC] = &&vm_label_OP_ENVSETC,
+    [OP_ENVUPKC] = &&vm_label_OP_ENVUPKC,
+    [OP_ENVARGC] = &&vm_label_OP_ENVARGC,
+    [OP_ENVPUSH] = &&vm_label_OP_ENVPUSH,
+    [OP_NOT] = &&vm_label_OP_NOT,
+    [OP_INV] = &&vm_label_OP_INV,
+    [OP_LEN] = &&vm_label_OP_LEN,
+    [OP_ADD_II] = &&vm_label_OP_ADD_II,
+    [OP_SUB_II] = &&vm_label_OP_SUB_II,
+    [OP_MUL_II] = &&vm_label_OP_MUL_II,
+    [OP_CMPLT_II] = &&vm_label_OP_CMPLT_II,
+    [OP_CMPNLT_II] = &&vm_label_OP_CMPNLT_II,
+    [OP_CMPGT_II] = &&vm_label_OP_CMPGT_II,
+    [OP_CMPNGT_II] = &&vm_label_OP_CMPNGT_II,
+    [OP_CMPLE_II] = &&vm_label_OP_CMPLE_II,
+    [OP_CMPGE_II] = &&vm_label_OP_CMPGE_II,
+    [OP_ADD_FF] = &&vm_label_OP_ADD_FF,
+    [OP_SUB_FF] = &&vm_label_OP_SUB_FF,
+    [OP_MUL_FF] = &&vm_label_OP_MUL_FF,
+    [OP_DIV_FF] = &&vm_label_OP_DIV_FF,
+    [OP_CMPLT_FF] = &&vm_label_OP_CMPLT_FF,
+    [OP_CMPGT_FF] = &&vm_label_OP_CMPGT_FF,
+    [OP_CMPLE_FF] = &&vm_label_OP_CMPLE_FF,
+    [OP_CMPGE_FF] = &&vm_label_OP_CMPGE_FF,
+    [OP_ADD_SS] = &&vm_label_OP_ADD_SS,
+  };
+  #endif
+
+  struct Instruction * instruction;
+
+  VM_DISPATCH();
+
+  #ifndef VM_THREADED_DISPATCH
+  vm_dispatch:
+  instruction = vm_fetch_instruction(state);
+  vm_switch:
+  #endif
+  switch (instruction->opcode)
+  {
+    VM_CASE(OP_NOP): VM_NEXT();
+
+    VM_CASE(OP_RET):
+    {
+      // modl_object_display(vm_get_current_call_frame(state).environment->vartable);
+      struct ModlRegion * region = state->call_stack[state->csp].region;
+      if (base_csp == state->csp)
       {
-        // modl_object_display(vm_get_current_call_frame(state).environment->vartable);
+        if (NULL != region)
+        {
+          state->call_stack[state->csp].region = NULL;
+          vm_region_end(state, region);
+        }
         return vm_reg_read(state, REG(0));
-      } break;
+      }
+      vm_pop_call_frame(state);
+      if (NULL != region) vm_region_end(state, region);
+      else vm_safepoint(state);
+    } VM_NEXT();
 
-      case OP_MOV:
-      {
-        vm_reg_write(state, instruction.a[0].r[0], vm_reg_read(state, instruction.a[0].r[1]));
-      } break;
+    VM_CASE(OP_MOV):
+    {
+      vm_reg_write(state, instruction->a[0].r[0], vm_reg_read(state, instruction->a[0].r[1]));
+    } VM_NEXT();
 
-      case OP_LOADC:
-      {
-        vm_reg_write(state, instruction.a[0].r[0], instruction.a[1].object);
-      } break;
+    VM_CASE(OP_LOADC):
+    {
+      struct ModlObject const constant = state->constants[instruction->a[1].constant];
+      if (ModlTypeTable == modl_object_type(constant))
+        vm_reg_write(state, instruction->a[0].r[0],
+          modl_table_with_capacity(modl_to_ref(constant)->value.table.array_capacity, 0));
+      else
+        vm_reg_write(state, instruction->a[0].r[0], constant);
+    } VM_NEXT();
+
+    VM_CASE(OP_TBLGETR):
+    {
+      byte const reg_tbl = instruction->a[0].r[0];
+      byte const reg_name = instruction->a[0].r[1];
 
-      case OP_TBLGETR:
+      struct ModlObject obj_tbl = vm_reg_read(state, reg_tbl);
+      struct ModlObject obj_name = vm_reg_read(state, reg_name);
+
+      struct TableCache * const cache = &state->table_caches[instruction->a[1].cache];
+      if (ModlTypeTable == modl_object_type(obj_tbl) && ModlTypeString == modl_object_type(obj_name))
       {
-        byte const reg_tbl = instruction.a[0].r[0];
-        byte const reg_name = instruction.a[0].r[1];
+        struct ModlMap const * const map = &modl_to_ref(obj_tbl)->value.table;
+        struct ModlShape * const shape = modl_map_shape(map);
+        if (NULL != shape && shape == cache->shape && NULL == cache->target
+            && modl_to_ref(obj_name) == modl_to_ref(cache->key))
+        {
+          struct ModlObject const * field = modl_map_field(map, cache->slot);
+          if (NULL != field)
+          {
+            state->table_cache_hits += 1;
+            vm_reg_write(state, reg_tbl, *field);
+            VM_NEXT();
+          }
+        }
 
-        struct ModlObject obj_tbl = vm_reg_read(state, reg_tbl);
-        struct ModlObject obj_name = vm_reg_read(state, reg_name);
+        state->table_cache_misses += 1;
+        uint32_t const slot = NULL != shape ? modl_shape_find(shape, obj_name) : UINT32_MAX;
+        if (UINT32_MAX != slot)
+          vm_table_cache_set(cache, shape, NULL, obj_name, slot);
+      }
 
-        vm_reg_write(
-          state, reg_tbl,
-          modl_table_get_v(&obj_tbl, obj_name)
-        );
-      } break;
+      vm_reg_write(
+        state, reg_tbl,
+        modl_table_get_v(&obj_tbl, obj_name)
+      );
+    } VM_NEXT();
 
-      case OP_CALLR:
+    VM_CASE(OP_CALLR):
+    {
+      struct ModlObject obj = vm_reg_read(state, instruction->a[0].r[0]);
+      if (ModlTypeFunction == modl_object_type(obj) && not modl_to_ref(obj)->value.fun.is_external)
       {
-        struct ModlObject obj = vm_reg_read(state, instruction.a[0].r[0]);
-        vm_call_function(state, obj);
-      } break;
+        /* the base frame has no pooled environment to reuse */
+        if (OP_RET == state->code[state->ip + 1].opcode && state->csp > 0)
+          vm_replace_call_frame(state, obj, 0, NULL);
+        else
+          vm_push_call_frame(state, obj, 0, NULL);
+        VM_DISPATCH();
+      }
 
-      case OP_LOADFUN:
-      {
-        struct Environment * env = state->call_stack[state->csp].environment;
-        vm_reg_write(state, instruction.a[0].r[0], ifun_to_modl(env, state->ip + instruction.a[1].i64));
-      } break;
+      if (ModlTypeFunction == modl_object_type(obj))
+        vm_call_external_function_from_stack(state, obj);
+      else
+        vm_call_function(state, obj, 0, NULL);
+    } VM_NEXT();
+
+    VM_CASE(OP_CALLW):
+    {
+      struct ModlObject obj = vm_reg_read(state, instruction->a[0].r[0]);
+      byte const first = instruction->a[0].r[1];
+      byte const argc = instruction->a[1].r[0];
+
+      #ifndef VM_FAST
+      for (byte i = 0; i < argc; ++i)
+        vm_reg_read(state, first + i);
+      #endif
 
-      case OP_JMP: state->ip += instruction.a[0].i64 - instruction.byte_length; break;
-
-      case OP_ROL:
-      case OP_ROR:
-      case OP_IDIV:
-      case OP_ADD:
-      case OP_SUB:
-      case OP_MUL:
-      case OP_DIV:
-      case OP_MOD:
-      case OP_AND:
-      case OP_OR:
-      case OP_XOR:
-      case OP_NAND:
-      case OP_NOR:
-      case OP_NXOR:
-      case OP_CMPLT:
-      case OP_CMPNLT:
-      case OP_CMPGT:
-      case OP_CMPNGT:
-      case OP_CMPLE:
-      case OP_CMPNLE:
-      case OP_CMPGE:
-      case OP_CMPNGE:
+      struct ModlObject const * argv = &state->registers[first];
+      if (ModlTypeFunction == modl_object_type(obj) && not modl_to_ref(obj)->value.fun.is_external)
       {
-        byte const reg_dst = instruction.a[0].r[0];
-        byte const reg_src = instruction.a[0].r[1];
+        if (OP_RET == state->code[state->ip + 1].opcode && state->csp > 0)
+          vm_replace_call_frame(state, obj, argc, argv);
+        else
+          vm_push_call_frame(state, obj, argc, argv);
+        VM_DISPATCH();
+      }
 
-        struct ModlObject obj_l = modl_object_disown(vm_reg_read(state, reg_dst));
-        state->registers[reg_dst] = modl_nil();
-        struct ModlObject obj_r = vm_reg_read(state, reg_src);
+      vm_call_function(state, obj, argc, argv);
+    } VM_NEXT();
 
-        if (modl_object_type_is(obj_l, ModlTypeFloating))
-        {
-          obj_r = modl_maybe_cast(obj_r, ModlTypeFloating);
-        }
-        else if (modl_object_type_is(obj_r, ModlTypeFloating))
-        {
-          obj_l = modl_maybe_cast(obj_l, ModlTypeFloating);
-        }
+    VM_CASE(OP_REGION):
+    {
+      struct CallFrame * frame = &state->call_stack[state->csp];
+      if (NULL == frame->region) frame->region = modl_pool_region_begin();
+    } VM_NEXT();
 
-        if (obj_l.type != obj_r.type)
-        {
-          printf(
-            "\x1b[31;1m  Values are required to have the same type: %s <> %s\x1b[0m\n",
-            modl_types_names_table[obj_l.type],
-            modl_types_names_table[obj_r.type]
-          );
-          exit(EXIT_FAILURE);
-        }
+    VM_CASE(OP_LOADFUN):
+    {
+      struct Environment * env = state->call_stack[state->csp].environment;
+      env->captured = TRUE;
+      vm_reg_write(state, instruction->a[0].r[0], ifun_to_modl(env, instruction->a[1].i64));
+    } VM_NEXT();
+
+    VM_CASE(OP_JMP):
+    {
+      /* loops jump back, so a safepoint here bounds the time between two */
+      vm_safepoint(state);
+      state->ip = instruction->a[0].i64;
+    } VM_DISPATCH();
+
+    VM_CASE(OP_ROL):
+    VM_CASE(OP_ROR):
+    VM_CASE(OP_IDIV):
+    VM_CASE(OP_ADD):
+    VM_CASE(OP_SUB):
+    VM_CASE(OP_MUL):
+    VM_CASE(OP_DIV):
+    VM_CASE(OP_MOD):
+    VM_CASE(OP_AND):
+    VM_CASE(OP_OR):
+    VM_CASE(OP_XOR):
+    VM_CASE(OP_NAND):
+    VM_CASE(OP_NOR):
+    VM_CASE(OP_NXOR):
+    VM_CASE(OP_CMPLT):
+    VM_CASE(OP_CMPNLT):
+    VM_CASE(OP_CMPGT):
+    VM_CASE(OP_CMPNGT):
+    VM_CASE(OP_CMPLE):
+    VM_CASE(OP_CMPNLE):
+    VM_CASE(OP_CMPGE):
+    VM_CASE(OP_CMPNGE):
+    {
+      enum ModlOpcode const opcode = instruction->opcode;
+      byte const reg_dst = instruction->a[0].r[0];
+      byte const reg_src = instruction->a[0].r[1];
+
+      struct ModlObject obj_l = modl_object_disown(vm_reg_read(state, reg_dst));
+      state->registers[reg_dst] = modl_nil();
+      struct ModlObject obj_r = vm_reg_read(state, reg_src);
 
-        if (ModlTypeString == obj_l.type && instruction.opcode == OP_ADD)
+      if (not (instruction->flags & INSTRUCTION_FLAG_GENERIC))
+      {
+        enum ModlOpcode const quickened = vm_quickened_opcode(instruction->opcode, modl_object_type(obj_l), modl_object_type(obj_r));
+        if (OP_NOP != quickened)
         {
-          state->stack[state->sp++] = modl_object_take(obj_r);
-          state->stack[state->sp++] = modl_object_take(obj_l);
-          vm_reg_write(state, reg_dst, modl_std_concat_strings(state));
-          break;
+          instruction->opcode = quickened;
+          state->quickenings += 1;
         }
+      }
+
+      if (modl_object_type_is(obj_l, ModlTypeFloating))
+      {
+        obj_r = modl_maybe_cast(obj_r, ModlTypeFloating);
+      }
+      else if (modl_object_type_is(obj_r, ModlTypeFloating))
+      {
+        struct ModlObject const cast = modl_maybe_cast(obj_l, ModlTypeFloating);
+        modl_object_release_tmp(obj_l);
+        obj_l = cast;
+      }
+
+      if (modl_object_type(obj_l) != modl_object_type(obj_r))
+      {
+        printf(
+          "\x1b[31;1m  Values are required to have the same type: %s <> %s\x1b[0m\n",
+          modl_types_names_table[modl_object_type(obj_l)],
+          modl_types_names_table[modl_object_type(obj_r)]
+        );
+        exit(EXIT_FAILURE);
+      }
+
+      if (ModlTypeString == modl_object_type(obj_l) && opcode == OP_ADD)
+      {
+        struct ModlObject const args[] = { obj_l, obj_r };
+        struct ModlObject const result = modl_std_concat_strings(state, 2, args);
+        modl_object_release_tmp(obj_l);
+        vm_reg_write(state, reg_dst, result);
+        VM_NEXT();
+      }
 
-        if (ModlTypeInteger != obj_l.type && ModlTypeFloating != obj_l.type)
+      if (ModlTypeInteger != modl_object_type(obj_l) && ModlTypeFloating != modl_object_type(obj_l))
+      {
+        printf(
+          "\x1b[31;1m  This operation requires operands of integer or floating types: %s <> %s/%s\x1b[0m\n",
+          modl_types_names_table[modl_object_type(obj_l)],
+          modl_types_names_table[ModlTypeInteger],
+          modl_types_names_table[ModlTypeFloating]
+        );
+        exit(EXIT_FAILURE);
+      }
+
+      switch (ModlTypeInteger == modl_object_type(obj_l))
+      {
+        case TRUE: switch (opcode)
         {
-          printf(
-            "\x1b[31;1m  This operation requires operands of integer or floating types: %s <> %s/%s\x1b[0m\n",
-            modl_types_names_table[obj_l.type],
-            modl_types_names_table[ModlTypeInteger],
-            modl_types_names_table[ModlTypeFloating]
-          );
-          exit(EXIT_FAILURE);
+          case OP_ROL: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) << modl_to_int(obj_r)); break;
+          case OP_ROR: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) >> modl_to_int(obj_r)); break;
+          case OP_IDIV: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) / modl_to_int(obj_r)); break;
+          case OP_ADD: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) + modl_to_int(obj_r)); break;
+          case OP_SUB: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) - modl_to_int(obj_r)); break;
+          case OP_MUL: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) * modl_to_int(obj_r)); break;
+          case OP_DIV: vm_reg_write(state, reg_dst, double_to_modl((double)modl_to_int(obj_l) / (double)modl_to_int(obj_r))); break;
+          case OP_MOD: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) % modl_to_int(obj_r)); break;
+          case OP_AND: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) & modl_to_int(obj_r)); break;
+          case OP_OR: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) | modl_to_int(obj_r)); break;
+          case OP_XOR: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) ^ modl_to_int(obj_r)); break;
+          case OP_NAND: vm_reg_write_i(state, reg_dst, ~(modl_to_int(obj_l) & modl_to_int(obj_r))); break;
+          case OP_NOR: vm_reg_write_i(state, reg_dst, ~(modl_to_int(obj_l) | modl_to_int(obj_r))); break;
+          case OP_NXOR: vm_reg_write_i(state, reg_dst, ~(modl_to_int(obj_l) ^ modl_to_int(obj_r))); break;
+          case OP_CMPLT: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_int(obj_l) < modl_to_int(obj_r))); break;
+          case OP_CMPNLT: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_int(obj_l) < modl_to_int(obj_r)))); break;
+          case OP_CMPGT: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_int(obj_l) > modl_to_int(obj_r))); break;
+          case OP_CMPNGT: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_int(obj_l) > modl_to_int(obj_r)))); break;
+          case OP_CMPLE: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_int(obj_l) <= modl_to_int(obj_r))); break;
+          case OP_CMPNLE: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_int(obj_l) <= modl_to_int(obj_r)))); break;
+          case OP_CMPGE: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_int(obj_l) >= modl_to_int(obj_r))); break;
+          case OP_CMPNGE: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_int(obj_l) >= modl_to_int(obj_r)))); break;
+          default: break;
         }
+        /* integers too large for a NaN-boxed object are references */
+        modl_object_release_tmp(obj_l);
+        break;
 
-        switch (ModlTypeInteger == obj_l.type)
+        case FALSE: switch (opcode)
         {
-          case TRUE: switch (instruction.opcode)
+          case OP_ADD: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) + modl_to_double(obj_r))); break;
+          case OP_SUB: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) - modl_to_double(obj_r))); break;
+          case OP_MUL: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) * modl_to_double(obj_r))); break;
+          case OP_DIV: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) / modl_to_double(obj_r))); break;
+          case OP_MOD: vm_reg_write(state, reg_dst, double_to_modl(fmod(modl_to_double(obj_l), modl_to_double(obj_r)))); break;
+          // case OP_AND: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) & modl_to_double(obj_r))); break;
+          // case OP_OR: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) | modl_to_double(obj_r))); break;
+          // case OP_XOR: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) ^ modl_to_double(obj_r))); break;
+          // case OP_NAND: vm_reg_write(state, reg_dst, double_to_modl(~(modl_to_double(obj_l) & modl_to_double(obj_r)))); break;
+          // case OP_NOR: vm_reg_write(state, reg_dst, double_to_modl(~(modl_to_double(obj_l) | modl_to_double(obj_r)))); break;
+          // case OP_NXOR: vm_reg_write(state, reg_dst, double_to_modl(~(modl_to_double(obj_l) ^ modl_to_double(obj_r)))); break;
+          case OP_CMPLT: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_double(obj_l) < modl_to_double(obj_r))); break;
+          case OP_CMPNLT: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_double(obj_l) < modl_to_double(obj_r)))); break;
+          case OP_CMPGT: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_double(obj_l) > modl_to_double(obj_r))); break;
+          case OP_CMPNGT: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_double(obj_l) > modl_to_double(obj_r)))); break;
+          case OP_CMPLE: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_double(obj_l) <= modl_to_double(obj_r))); break;
+          case OP_CMPNLE: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_double(obj_l) <= modl_to_double(obj_r)))); break;
+          case OP_CMPGE: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_double(obj_l) >= modl_to_double(obj_r))); break;
+          case OP_CMPNGE: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_double(obj_l) >= modl_to_double(obj_r)))); break;
+          default:
           {
-            case OP_ROL: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) << modl_to_int(obj_r)); break;
-            case OP_ROR: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) >> modl_to_int(obj_r)); break;
-            case OP_IDIV: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) / modl_to_int(obj_r)); break;
-            case OP_ADD: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) + modl_to_int(obj_r)); break;
-            case OP_SUB: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) - modl_to_int(obj_r)); break;
-            case OP_MUL: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) * modl_to_int(obj_r)); break;
-            case OP_DIV: vm_reg_write(state, reg_dst, double_to_modl((double)modl_to_int(obj_l) / (double)modl_to_int(obj_r))); break;
-            case OP_MOD: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) % modl_to_int(obj_r)); break;
-            case OP_AND: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) & modl_to_int(obj_r)); break;
-            case OP_OR: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) | modl_to_int(obj_r)); break;
-            case OP_XOR: vm_reg_write_i(state, reg_dst, modl_to_int(obj_l) ^ modl_to_int(obj_r)); break;
-            case OP_NAND: vm_reg_write_i(state, reg_dst, ~(modl_to_int(obj_l) & modl_to_int(obj_r))); break;
-            case OP_NOR: vm_reg_write_i(state, reg_dst, ~(modl_to_int(obj_l) | modl_to_int(obj_r))); break;
-            case OP_NXOR: vm_reg_write_i(state, reg_dst, ~(modl_to_int(obj_l) ^ modl_to_int(obj_r))); break;
-            case OP_CMPLT: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_int(obj_l) < modl_to_int(obj_r))); break;
-            case OP_CMPNLT: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_int(obj_l) < modl_to_int(obj_r)))); break;
-            case OP_CMPGT: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_int(obj_l) > modl_to_int(obj_r))); break;
-            case OP_CMPNGT: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_int(obj_l) > modl_to_int(obj_r)))); break;
-            case OP_CMPLE: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_int(obj_l) <= modl_to_int(obj_r))); break;
-            case OP_CMPNLE: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_int(obj_l) <= modl_to_int(obj_r)))); break;
-            case OP_CMPGE: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_int(obj_l) >= modl_to_int(obj_r))); break;
-            case OP_CMPNGE: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_int(obj_l) >= modl_to_int(obj_r)))); break;
-            default: break;
+            printf("%s\n", "\x1b[31;1m  this operation is not supported on floats\x1b[0m");
+            exit(EXIT_FAILURE);
           } break;
+        } break;
+      }
+    } VM_NEXT();
+
+    /* Quickened variants check operand types and on mismatch turn the site
+       back into the generic instruction for good. */
+    #define VM_DEOPTIMIZE(OP) do { \
+      instruction->opcode = OP; \
+      instruction->flags |= INSTRUCTION_FLAG_GENERIC; \
+      state->deoptimizations += 1; \
+      VM_GOTO_CASE(OP); \
+    } while (0)
+
+    #define VM_QUICKENED(QOP, OP, TYPE, RESULT) \
+    VM_CASE(QOP): \
+    { \
+      byte const reg_dst = instruction->a[0].r[0]; \
+      struct ModlObject const obj_l = vm_reg_read(state, reg_dst); \
+      struct ModlObject const obj_r = vm_reg_read(state, instruction->a[0].r[1]); \
+      if (TYPE != modl_object_type(obj_l) || TYPE != modl_object_type(obj_r)) VM_DEOPTIMIZE(OP); \
+      vm_reg_write(state, reg_dst, RESULT); \
+    } VM_NEXT()
+
+    VM_QUICKENED(OP_ADD_II, OP_ADD, ModlTypeInteger, int_to_modl(modl_to_int(obj_l) + modl_to_int(obj_r)));
+    VM_QUICKENED(OP_SUB_II, OP_SUB, ModlTypeInteger, int_to_modl(modl_to_int(obj_l) - modl_to_int(obj_r)));
+    VM_QUICKENED(OP_MUL_II, OP_MUL, ModlTypeInteger, int_to_modl(modl_to_int(obj_l) * modl_to_int(obj_r)));
+    VM_QUICKENED(OP_CMPLT_II, OP_CMPLT, ModlTypeInteger, bool_to_modl(modl_to_int(obj_l) < modl_to_int(obj_r)));
+    VM_QUICKENED(OP_CMPNLT_II, OP_CMPNLT, ModlTypeInteger, bool_to_modl(!(modl_to_int(obj_l) < modl_to_int(obj_r))));
+    VM_QUICKENED(OP_CMPGT_II, OP_CMPGT, ModlTypeInteger, bool_to_modl(modl_to_int(obj_l) > modl_to_int(obj_r)));
+    VM_QUICKENED(OP_CMPNGT_II, OP_CMPNGT, ModlTypeInteger, bool_to_modl(!(modl_to_int(obj_l) > modl_to_int(obj_r))));
+    VM_QUICKENED(OP_CMPLE_II, OP_CMPLE, ModlTypeInteger, bool_to_modl(modl_to_int(obj_l) <= modl_to_int(obj_r)));
+    VM_QUICKENED(OP_CMPGE_II, OP_CMPGE, ModlTypeInteger, bool_to_modl(modl_to_int(obj_l) >= modl_to_int(obj_r)));
+
+    VM_QUICKENED(OP_ADD_FF, OP_ADD, ModlTypeFloating, double_to_modl(modl_to_double(obj_l) + modl_to_double(obj_r)));
+    VM_QUICKENED(OP_SUB_FF, OP_SUB, ModlTypeFloating, double_to_modl(modl_to_double(obj_l) - modl_to_double(obj_r)));
+    VM_QUICKENED(OP_MUL_FF, OP_MUL, ModlTypeFloating, double_to_modl(modl_to_double(obj_l) * modl_to_double(obj_r)));
+    VM_QUICKENED(OP_DIV_FF, OP_DIV, ModlTypeFloating, double_to_modl(modl_to_double(obj_l) / modl_to_double(obj_r)));
+    VM_QUICKENED(OP_CMPLT_FF, OP_CMPLT, ModlTypeFloating, bool_to_modl(modl_to_double(obj_l) < modl_to_double(obj_r)));
+    VM_QUICKENED(OP_CMPGT_FF, OP_CMPGT, ModlTypeFloating, bool_to_modl(modl_to_double(obj_l) > modl_to_double(obj_r)));
+    VM_QUICKENED(OP_CMPLE_FF, OP_CMPLE, ModlTypeFloating, bool_to_modl(modl_to_double(obj_l) <= modl_to_double(obj_r)));
+    VM_QUICKENED(OP_CMPGE_FF, OP_CMPGE, ModlTypeFloating, bool_to_modl(modl_to_double(obj_l) >= modl_to_double(obj_r)));
+
+    #undef VM_QUICKENED
+
+    VM_CASE(OP_ADD_SS):
+    {
+      byte const reg_dst = instruction->a[0].r[0];
+      struct ModlObject const obj_r = vm_reg_read(state, instruction->a[0].r[1]);
+      if (ModlTypeString != modl_object_type(state->registers[reg_dst]) || ModlTypeString != modl_object_type(obj_r))
+        VM_DEOPTIMIZE(OP_ADD);
+
+      struct ModlObject obj_l = modl_object_disown(vm_reg_read(state, reg_dst));
+      state->registers[reg_dst] = modl_nil();
+      struct ModlObject const args[] = { obj_l, obj_r };
+      struct ModlObject const result = modl_std_concat_strings(state, 2, args);
+      modl_object_release_tmp(obj_l);
+      vm_reg_write(state, reg_dst, result);
+    } VM_NEXT();
+
+    #undef VM_DEOPTIMIZE
+
+    VM_CASE(OP_CMPEQ):
+    VM_CASE(OP_CMPNEQ):
+    {
+      vm_reg_write(state, instruction->a[0].r[0], bool_to_modl(modl_object_equals(
+        vm_reg_read(state, instruction->a[0].r[0]),
+        vm_reg_read(state, instruction->a[0].r[1])
+      ) == (instruction->opcode == OP_CMPEQ)));
+    } VM_NEXT();
 
-          case FALSE: switch (instruction.opcode)
-          {
-            case OP_ADD: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) + modl_to_double(obj_r))); break;
-            case OP_SUB: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) - modl_to_double(obj_r))); break;
-            case OP_MUL: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) * modl_to_double(obj_r))); break;
-            case OP_DIV: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) / modl_to_double(obj_r))); break;
-            case OP_MOD: vm_reg_write(state, reg_dst, double_to_modl(fmod(modl_to_double(obj_l), modl_to_double(obj_r)))); break;
-            // case OP_AND: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) & modl_to_double(obj_r))); break;
-            // case OP_OR: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) | modl_to_double(obj_r))); break;
-            // case OP_XOR: vm_reg_write(state, reg_dst, double_to_modl(modl_to_double(obj_l) ^ modl_to_double(obj_r))); break;
-            // case OP_NAND: vm_reg_write(state, reg_dst, double_to_modl(~(modl_to_double(obj_l) & modl_to_double(obj_r)))); break;
-            // case OP_NOR: vm_reg_write(state, reg_dst, double_to_modl(~(modl_to_double(obj_l) | modl_to_double(obj_r)))); break;
-            // case OP_NXOR: vm_reg_write(state, reg_dst, double_to_modl(~(modl_to_double(obj_l) ^ modl_to_double(obj_r)))); break;
-            case OP_CMPLT: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_double(obj_l) < modl_to_double(obj_r))); break;
-            case OP_CMPNLT: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_double(obj_l) < modl_to_double(obj_r)))); break;
-            case OP_CMPGT: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_double(obj_l) > modl_to_double(obj_r))); break;
-            case OP_CMPNGT: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_double(obj_l) > modl_to_double(obj_r)))); break;
-            case OP_CMPLE: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_double(obj_l) <= modl_to_double(obj_r))); break;
-            case OP_CMPNLE: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_double(obj_l) <= modl_to_double(obj_r)))); break;
-            case OP_CMPGE: vm_reg_write(state, reg_dst, bool_to_modl(modl_to_double(obj_l) >= modl_to_double(obj_r))); break;
-            case OP_CMPNGE: vm_reg_write(state, reg_dst, bool_to_modl(!(modl_to_double(obj_l) >= modl_to_double(obj_r)))); break;
-            default:
-            {
-              printf("%s\n", "\x1b[31;1m  this operation is not supported on floats\x1b[0m");
-              exit(EXIT_FAILURE);
-            } break;
-          } break;
-        }
-      } break;
 
-      case OP_CMPEQ:
-      case OP_CMPNEQ:
+    VM_CASE(OP_JCF):
+    VM_CASE(OP_JCT):
+    {
+      if (modl_to_bool(vm_reg_read(state, instruction->a[0].r[0])) == (instruction->opcode == OP_JCT))
       {
-        vm_reg_write(state, instruction.a[0].r[0], bool_to_modl(modl_object_equals(
-          vm_reg_read(state, instruction.a[0].r[0]),
-          vm_reg_read(state, instruction.a[0].r[1])
-        ) == (instruction.opcode == OP_CMPEQ)));
-      } break;
+        state->ip = instruction->a[1].i64;
+        VM_DISPATCH();
+      }
+    } VM_NEXT();
 
+    VM_CASE(OP_POP):
+    {
+      if (0 == state->sp)
+      {
+        printf("\x1b[31;1m  Cannot pop from empty stack\x1b[0m\n");
+        exit(EXIT_FAILURE);
+      }
 
-      case OP_JCF:
-      case OP_JCT:
+      state->sp -= 1;
+      vm_reg_write(state, instruction->a[0].r[0], modl_object_disown(state->stack[state->sp]));
+    } VM_NEXT();
+
+    VM_CASE(OP_PUSH):
+    {
+      if (state->sp + 1 > state->max_count_stack)
       {
-        if (modl_to_bool(vm_reg_read(state, instruction.a[0].r[0])) == (instruction.opcode == OP_JCT))
-          state->ip += instruction.a[1].i64 - instruction.byte_length;
-      } break;
+        printf(
+          "\x1b[31;1m%s: stack_max_size=%lu\x1b[0m\n",
+          "  maximum stack size exceeded",
+          state->max_count_stack
+        );
+        exit(EXIT_FAILURE);
+      }
+
+      state->stack[state->sp++] = modl_object_take(vm_reg_read(state, instruction->a[0].r[0]));
+    } VM_NEXT();
+
+    VM_CASE(OP_TBLPUSH):
+    {
+      // TODO: Use normal objects instead of pointers!!!!
+      struct ModlObject tmp = vm_reg_read(state, instruction->a[0].r[0]);
+      modl_table_push_v(
+        &tmp,
+        vm_region_escape(state, instruction->a[0].r[1], tmp)
+      );
+    } VM_NEXT();
+
+    VM_CASE(OP_TBLSETR):
+    {
+      struct ModlObject tmp = vm_reg_read(state, instruction->a[0].r[0]);
+      struct ModlObject const key = vm_region_escape(state, instruction->a[0].r[1], tmp);
+      struct ModlObject const val = vm_region_escape(state, instruction->a[1].r[0], tmp);
 
-      case OP_POP:
+      struct TableCache * const cache = &state->table_caches[instruction->a[1].cache];
+      if (ModlTypeTable != modl_object_type(tmp) || ModlTypeString != modl_object_type(key))
       {
-        if (0 == state->sp)
-        {
-          printf("\x1b[31;1m  Cannot pop from empty stack\x1b[0m\n");
-          exit(EXIT_FAILURE);
-        }
+        modl_table_insert_kv(&tmp, key, val);
+        VM_NEXT();
+      }
 
-        state->sp -= 1;
-        vm_reg_write(state, instruction.a[0].r[0], modl_object_disown(state->stack[state->sp]));
-      } break;
+      struct ModlMap * const map = &modl_to_ref(tmp)->value.table;
+      struct ModlShape * const shape = modl_map_shape(map);
+      if (NULL != shape && shape == cache->shape && modl_to_ref(key) == modl_to_ref(cache->key))
+      {
+        state->table_cache_hits += 1;
+        if (NULL == cache->target)
+          modl_map_set_field(map, cache->slot, val);
+        else
+          modl_map_add_field(map, cache->target, val);
+        VM_NEXT();
+      }
+
+      /* the shape left is only compared, it is alive if it is the parent */
+      state->table_cache_misses += 1;
+      modl_table_insert_kv(&tmp, key, val);
 
-      case OP_PUSH:
+      struct ModlShape * const target = modl_map_shape(map);
+      if (NULL == target)
+        VM_NEXT();
+      if (shape == target)
+        vm_table_cache_set(cache, shape, NULL, key, modl_shape_find(shape, key));
+      else if (shape == target->parent)
+        vm_table_cache_set(cache, shape, target, key, target->count - 1);
+    } VM_NEXT();
+
+    VM_CASE(OP_TBLITER):
+    {
+      struct ModlObject const tbl = vm_reg_read(state, instruction->a[0].r[0]);
+      if (ModlTypeTable != modl_object_type(tbl))
       {
-        if (state->sp + 1 > state->max_count_stack)
-        {
-          printf(
-            "\x1b[31;1m%s: stack_max_size=%lu\x1b[0m\n",
-            "  maximum stack size exceeded",
-            state->max_count_stack
-          );
-          exit(EXIT_FAILURE);
-        }
+        printf("\x1b[31;1m%s\x1b[0m\n", "  table iteration expects a table");
+        exit(EXIT_FAILURE);
+      }
 
-        state->stack[state->sp++] = modl_object_take(vm_reg_read(state, instruction.a[0].r[0]));
-      } break;
+      /* slots moved by a pending resize could be skipped */
+      modl_map_finish_resize(&modl_to_ref(tbl)->value.table);
+      vm_reg_write_i(state, instruction->a[0].r[1], 0);
+    } VM_NEXT();
+
+    VM_CASE(OP_TBLNEXT):
+    {
+      struct ModlObject const tbl = vm_reg_read(state, instruction->a[0].r[0]);
+      byte const rc = instruction->a[0].r[1];
+      uint64_t cursor = (uint64_t) modl_to_int(vm_reg_read(state, rc));
+      struct ModlObject key, val;
 
-      case OP_TBLPUSH:
+      if (ModlTypeTable != modl_object_type(tbl))
       {
-        // TODO: Use normal objects instead of pointers!!!!
-        struct ModlObject tmp = vm_reg_read(state, instruction.a[0].r[0]);
-        modl_table_push_v(
-          &tmp,
-          vm_reg_read(state, instruction.a[0].r[1])
-        );
-      } break;
+        printf("\x1b[31;1m%s\x1b[0m\n", "  table iteration expects a table");
+        exit(EXIT_FAILURE);
+      }
 
-      case OP_TBLSETR:
+      if (not modl_map_next(&modl_to_ref(tbl)->value.table, &cursor, &key, &val))
       {
-        struct ModlObject tmp = vm_reg_read(state, instruction.a[0].r[0]);
-        modl_table_insert_kv(
-          &tmp,
-          vm_reg_read(state, instruction.a[0].r[1]),
-          vm_reg_read(state, instruction.a[1].r[0])
-        );
-      } break;
+        state->ip = instruction->a[1].i64;
+        VM_DISPATCH();
+      }
+
+      vm_reg_write_i(state, rc, (int64_t) cursor);
+      vm_reg_write(state, rc + 1, key);
+      vm_reg_write(state, rc + 2, val);
+    } VM_NEXT();
+
+    VM_CASE(OP_TBLDELR):
+    {
+      struct ModlObject tmp = vm_reg_read(state, instruction->a[0].r[0]);
+      modl_table_remove_k(&tmp, vm_reg_read(state, instruction->a[0].r[1]));
+    } VM_NEXT();
+
+    VM_CASE(OP_ENVGETC):
+    {
+      struct EnvironmentCache * const cache = &state->environment_caches[instruction->a[1].cache];
+      struct Environment * env = state->call_stack[state->csp].environment;
+
+      uint64_t const signature = vm_environment_signature(env);
+
+      if (signature == cache->signature
+          && state->binding_epochs[cache->epoch_slot] == cache->epoch)
+      {
+        /* the current environment is the only one of a different activation */
+        struct Environment const * cached = 0 == cache->depth ? env : cache->environment;
+        if ((0 == cache->depth || cached->activation == cache->activation)
+            && cache->slot < cached->next_variable_id
+            && vm_variable_is_bound(&cached->variables[cache->slot]))
+        {
+          state->environment_cache_hits += 1;
+          vm_reg_write(state, instruction->a[0].r[0], cached->variables[cache->slot]);
+          VM_NEXT();
+        }
+      }
 
-      case OP_ENVGETC:
+      state->environment_cache_misses += 1;
+      struct ModlObject const name = state->constants[instruction->a[1].constant];
+      bool cacheable = TRUE;
+      for (uint32_t depth = 0; NULL != env; ++depth, env = env->parent)
       {
-        struct Environment * env = state->call_stack[state->csp].environment;
-        // modl_object_display(state->call_stack[state->csp].environment->vartable);
-        // printf("%c", '\n');
-        
-        while (NULL != env)
+        struct ModlObject const * id = modl_map_get(&modl_to_ref(env->nametable)->value.table, name);
+        if (NULL == id) continue;
+
+        uint32_t const slot = (uint32_t) modl_to_int(*id);
+        if (slot < env->next_variable_id && vm_variable_is_bound(&env->variables[slot]))
         {
-          if (modl_table_has_k(&env->vartable, instruction.a[1].object))
+          if (cacheable)
           {
-            vm_reg_write(
-              state, instruction.a[0].r[0],
-              modl_table_get_v(
-                &env->vartable,
-                instruction.a[1].object
-              )
-            );
-            goto CASE_OP_ENVGETC_END;
+            byte const epoch_slot = modl_object_hash(name) % VM_SETTING_BINDING_EPOCHS_COUNT;
+            *cache = (struct EnvironmentCache) {
+              .signature = signature,
+              .environment = env,
+              .activation = env->activation,
+              .depth = depth,
+              .slot = slot,
+              .epoch = state->binding_epochs[epoch_slot],
+              .epoch_slot = epoch_slot,
+            };
           }
-          env = env->parent;
+          vm_reg_write(state, instruction->a[0].r[0], env->variables[slot]);
+          VM_NEXT();
         }
-        vm_reg_write(state, instruction.a[0].r[0], modl_nil());
-        CASE_OP_ENVGETC_END: break;
-      } break;
 
-      case OP_ENVSETC:
-      {
-        modl_table_insert_kv(
-          &state->call_stack[state->csp].environment->vartable,
-          instruction.a[1].object,
-          vm_reg_read(state, instruction.a[0].r[0])
-        );
-        // modl_object_display(state->call_stack[state->csp].environment->vartable);
-        // printf("%c", '\n');
-      } break;
+        /* name is known here but unset in this activation */
+        cacheable = FALSE;
+      }
+      vm_reg_write(state, instruction->a[0].r[0], modl_nil());
+    } VM_NEXT();
 
-      case OP_ENVUPKC:
-      {
-        byte const reg_val = instruction.a[0].r[0];
-        byte const reg_arg = instruction.a[0].r[1];
+    VM_CASE(OP_ENVSETC):
+    {
+      struct Environment * env = state->call_stack[state->csp].environment;
+      uint32_t const slot = vm_environment_cached_slot(state, instruction, env);
+      vm_environment_store(env, slot, vm_reg_read(state, instruction->a[0].r[0]));
+    } VM_NEXT();
 
-        struct ModlObject obj_vals = vm_reg_read(state, reg_val);
-        struct ModlObject obj_args = vm_reg_read(state, reg_arg);
+    VM_CASE(OP_ENVARGC):
+    {
+      struct CallFrame const * frame = &state->call_stack[state->csp];
+      byte const index = instruction->a[0].r[0];
+      uint32_t const slot = vm_environment_cached_slot(state, instruction, frame->environment);
+      vm_environment_store(
+        frame->environment, slot,
+        index < frame->argc ? state->stack[frame->arguments + index] : modl_nil()
+      );
+    } VM_NEXT();
 
-        struct ModlObject index = int_to_modl(0);
-        while (modl_table_has_k(&obj_vals, index) && modl_table_has_k(&obj_args, index))
-        {
-          modl_table_insert_kv(
-            &vm_get_current_environment(state)->vartable,
-            modl_table_get_v(&obj_args, index),
-            modl_table_get_v(&obj_vals, index)
-          );
-          index.value.integer += 1;
-        }
+    VM_CASE(OP_ENVUPKC):
+    {
+      byte const reg_val = instruction->a[0].r[0];
+      byte const reg_arg = instruction->a[0].r[1];
 
-        modl_object_release_tmp(index);
-      } break;
+      struct ModlObject obj_vals = vm_reg_read(state, reg_val);
+      struct ModlObject obj_args = vm_reg_read(state, reg_arg);
 
-      case OP_ENVPUSH:
+      struct ModlObject index = int_to_modl(0);
+      while (modl_table_has_k(&obj_vals, index) && modl_table_has_k(&obj_args, index))
       {
+        vm_environment_set(
+          state, vm_get_current_environment(state),
+          modl_table_get_v(&obj_args, index),
+          modl_table_get_v(&obj_vals, index)
+        );
+        index = int_to_modl(modl_to_int(index) + 1);
+      }
 
-      } break;
+      modl_object_release_tmp(index);
+    } VM_NEXT();
 
-      case OP_NOT:
-      {
-        struct ModlObject obj = vm_reg_read(state, instruction.a[0].r[0]);
-        vm_reg_write(state, instruction.a[0].r[0], bool_to_modl(!modl_to_bool(obj)));
-      } break;
+    VM_CASE(OP_ENVPUSH):
+    {
 
-      case OP_INV:
-      {
-        struct ModlObject obj = vm_reg_read(state, instruction.a[0].r[0]);
-        vm_reg_write_i(state, instruction.a[0].r[0], ~modl_to_int(obj));
-      } break;
+    } VM_NEXT();
 
-      case OP_LEN:
-      {
-        struct ModlObject obj = vm_reg_read(state, instruction.a[0].r[0]);
-        int64_t length = 0;
-        // Need to throw an error if type can not be taken length of
-        if (obj.type == ModlTypeTable)
-        {
-          struct ModlObject key = int_to_modl(0);
-          while (modl_table_has_k(&obj, key))
-          {
-            ++length;
-            ++key.value.integer;
-          }
-        }
-        else if (obj.type == ModlTypeString)
-        {
-          length = strlen(obj.value.ref->value.string);
-        }
-        else
-        {
-          printf(
-            "\x1b[31;1m  Length of object of type %s cannot be taken\x1b[0m\n",
-            modl_types_names_table[obj.type]
-          );
-          exit(EXIT_FAILURE);
-        }
+    VM_CASE(OP_NOT):
+    {
+      struct ModlObject obj = vm_reg_read(state, instruction->a[0].r[0]);
+      vm_reg_write(state, instruction->a[0].r[0], bool_to_modl(!modl_to_bool(obj)));
+    } VM_NEXT();
 
-        vm_reg_write_i(state, instruction.a[0].r[0], length);
-      } break;
+    VM_CASE(OP_INV):
+    {
+      struct ModlObject obj = vm_reg_read(state, instruction->a[0].r[0]);
+      vm_reg_write_i(state, instruction->a[0].r[0], ~modl_to_int(obj));
+    } VM_NEXT();
 
-      default:
+    VM_CASE(OP_LEN):
+    {
+      struct ModlObject obj = vm_reg_read(state, instruction->a[0].r[0]);
+      int64_t length = 0;
+      // Need to throw an error if type can not be taken length of
+      if (modl_object_type(obj) == ModlTypeTable)
       {
-        printf("\x1b[31;1m  Instruction implementation not found\x1b[0m\n");
+        length = modl_table_length(&obj);
+      }
+      else if (modl_object_type(obj) == ModlTypeString)
+      {
+        length = modl_to_ref(obj)->string_length;
+      }
+      else
+      {
+        printf(
+          "\x1b[31;1m  Length of object of type %s cannot be taken\x1b[0m\n",
+          modl_types_names_table[modl_object_type(obj)]
+        );
         exit(EXIT_FAILURE);
-      } break;
-    }
+      }
 
-    state->ip += instruction.byte_length;
-    instruction_release(instruction);
+      vm_reg_write_i(state, instruction->a[0].r[0], length);
+    } VM_NEXT();
+
+    VM_CASE_DEFAULT():
+    {
+      printf("\x1b[31;1m  Instruction implementation not found\x1b[0m\n");
+      exit(EXIT_FAILURE);
+    }
   }
 }
 
@@ -869,125 +1945,121 @@ struct ModlObject run(struct VMState * state)
 // }
 
 
+static void vm_check_arguments_count(char const * name, uint32_t argc, uint32_t expected)
+{
+  if (argc < expected)
+  {
+    printf("\x1b[31;1m  %s: expected %u arguments, got %u\x1b[0m\n", name, expected, argc);
+    exit(EXIT_FAILURE);
+  }
+}
+
 /* LEAK-FREE */
-static struct ModlObject modl_std_print(struct VMState * vm)
+static struct ModlObject modl_std_print(struct VMState * vm, uint32_t argc, struct ModlObject const * argv)
 {
-  modl_object_display(&vm->stack[--vm->sp]);
+  vm_check_arguments_count("print", argc, 1);
+  modl_object_display(&argv[0]);
   printf("%c", '\n');
-  modl_object_release(vm->stack[vm->sp]);
   return modl_nil();
 }
 
 /* LEAK-FREE */
-static struct ModlObject modl_std_concat_strings(struct VMState * vm)
+static struct ModlObject modl_std_concat_strings(struct VMState * vm, uint32_t argc, struct ModlObject const * argv)
 {
-  struct ModlObject a = vm->stack[--vm->sp];
-  struct ModlObject b = vm->stack[--vm->sp];
+  vm_check_arguments_count("concat", argc, 2);
+  struct ModlObject a = argv[0];
+  struct ModlObject b = argv[1];
 
-  if (ModlTypeString != a.type || ModlTypeString != b.type)
+  if (ModlTypeString != modl_object_type(a) || ModlTypeString != modl_object_type(b))
   {
     perror("std_concat_strings expected integer parameters");
     exit(EXIT_FAILURE);
   }
 
-  char res[strlen(a.value.ref->value.string) + strlen(b.value.ref->value.string) + 1];
-  strcpy(res, a.value.ref->value.string);
-  strcat(res, b.value.ref->value.string);
-
-  modl_object_release(a);
-  modl_object_release(b);
-
-  return str_to_modl(res);
+  return str_concat_to_modl(modl_to_ref(a)->value.string, modl_to_ref(a)->string_length,
+    modl_to_ref(b)->value.string, modl_to_ref(b)->string_length);
 }
 
 /* LEAK-FREE */
-static struct ModlObject modl_std_to_string(struct VMState * vm)
+static struct ModlObject modl_std_to_string(struct VMState * vm, uint32_t argc, struct ModlObject const * argv)
 {
-  struct ModlObject a = vm->stack[--vm->sp];
+  vm_check_arguments_count("toString", argc, 1);
+  struct ModlObject a = argv[0];
 
-  switch (a.type)
+  switch (modl_object_type(a))
   {
     case ModlTypeNil: return str_to_modl("nil");
     
     case ModlTypeBoolean:
     {
       bool val = modl_to_bool(a);
-      modl_object_release(a);
       return str_to_modl(val ? "true" : "false");
     }
 
     case ModlTypeInteger:
     {
       char res[21];
-      sprintf(res, "%ld", modl_to_int(a));
-      modl_object_release(a);
-      return str_to_modl(res);
+      int const length = sprintf(res, "%ld", modl_to_int(a));
+      return str_to_modl_n(res, length);
     }
 
     case ModlTypeFloating:
     {
       char res[64];
-      sprintf(res, "%.17g", modl_to_double(a));
-      modl_object_release(a);
-      return str_to_modl(res);
+      int const length = sprintf(res, "%.17g", modl_to_double(a));
+      return str_to_modl_n(res, length);
     }
 
     case ModlTypeString:
     {
-      return modl_object_disown(a);
+      return a;
     }
 
-    default: modl_object_release(a); return modl_nil();
+    default: return modl_nil();
   }
 }
 
-static struct ModlObject modl_std_string_substring(struct VMState * vm)
+static struct ModlObject modl_std_string_substring(struct VMState * vm, uint32_t argc, struct ModlObject const * argv)
 {
-  struct ModlObject str = vm->stack[--vm->sp];
-  struct ModlObject from = vm->stack[--vm->sp];
-  struct ModlObject length = vm->stack[--vm->sp];
-  char * csubstr = malloc((length.value.integer + 1) * sizeof (char));
-  
-  memcpy(csubstr, str.value.ref->value.string + from.value.integer, length.value.integer);
-  csubstr[length.value.integer] = '\0';
+  vm_check_arguments_count("substring", argc, 3);
+  struct ModlObject str = argv[0];
+  struct ModlObject from = argv[1];
+  struct ModlObject length = argv[2];
 
-  modl_object_release(from);
-  modl_object_release(length);
-  modl_object_release(str);
-  return transfer_str_to_modl(csubstr);
+  return str_to_modl_n(modl_to_ref(str)->value.string + modl_to_int(from), modl_to_int(length));
 }
 
-static struct ModlObject modl_std_string_to_array(struct VMState * vm)
+static struct ModlObject modl_std_string_to_array(struct VMState * vm, uint32_t argc, struct ModlObject const * argv)
 {
-  struct ModlObject str = vm->stack[--vm->sp];
-  struct ModlObject arr = modl_table();
-  char const * c = str.value.ref->value.string;
+  vm_check_arguments_count("toArray", argc, 1);
+  struct ModlObject str = argv[0];
+  char const * c = modl_to_ref(str)->value.string;
+  struct ModlObject arr = modl_table_with_capacity(modl_to_ref(str)->string_length, 0);
   char csc[2] = {0, 0};
 
   while ((*csc = *c++))
     modl_table_push_v(&arr, int_to_modl(*csc));
 
-  modl_object_release(str);
   return arr;
 }
 
-static struct ModlObject modl_std_string_from_array(struct VMState * vm)
+static struct ModlObject modl_std_string_from_array(struct VMState * vm, uint32_t argc, struct ModlObject const * argv)
 {
-  struct ModlObject arr = vm->stack[--vm->sp];
+  vm_check_arguments_count("fromArray", argc, 1);
+  struct ModlObject arr = argv[0];
 
-  char * cstr = malloc(arr.value.ref->value.table.size + 1);
+  char * cstr = malloc(modl_to_ref(arr)->value.table.size + 1);
   char * cc = cstr;
   
   struct ModlObject key = int_to_modl(0);
   while (modl_table_has_k(&arr, key))
   {
     *cc++ = (char) modl_to_int(modl_table_get_v(&arr, key));
-    key.value.integer += 1;
+    key = int_to_modl(modl_to_int(key) + 1);
   }
   *cc = '\0';
 
-  modl_object_release(arr);
-  return transfer_str_to_modl(cstr);
+  return transfer_str_to_modl_n(cstr, cc - cstr);
 }
 
 /*
@@ -1314,6 +2386,186 @@ static struct ModlObject * modl_std_array_map_flat(struct VMState * vm)
 */
 
 
+/*!
+ *  \brief Seed for hashing, from the system random source if available
+ */
+static uint64_t vm_random_seed()
+{
+  uint64_t seed = 0;
+  FILE * fp = fopen("/dev/urandom", "rb");
+  if (NULL != fp)
+  {
+    if (1 == fread(&seed, sizeof seed, 1, fp))
+    {
+      fclose(fp);
+      return seed;
+    }
+    fclose(fp);
+  }
+
+  return (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32) ^ (uint64_t) (uintptr_t) &seed ^ (uint64_t) clock();
+}
+
+
+/*!
+ *  \brief Create virtual machine with the standard library
+ *  \param base_environment Environment of the base call frame, natives are bound in it
+ *  \param max_count_call_stack Maximum depth of calls
+ *  \param max_count_stack Maximum number of values on the stack
+ *  \param max_count_externals Number of native function slots
+ *  \return Virtual machine without code
+ */
+static struct VMState vm_create(struct Environment * base_environment, size_t max_count_call_stack, size_t max_count_stack, size_t max_count_externals)
+{
+  struct VMState vm =
+  {
+    .code = NULL,
+
+    .max_count_call_stack = max_count_call_stack,
+    .max_count_stack = max_count_stack,
+    .max_count_externals = 16,
+
+    .ip = 0, .csp = 0, .sp = 0, .efc = 0,
+    .call_stack = (struct CallFrame *) malloc(max_count_call_stack * sizeof (struct CallFrame)),
+    .environments = (struct Environment *) calloc(max_count_call_stack, sizeof (struct Environment)),
+    .registers = { },
+    .stack = (struct ModlObject *) (malloc(max_count_stack * sizeof (struct ModlObject))),
+    .external_functions = (struct ExternalFunction *) malloc(max_count_externals * sizeof (struct ExternalFunction)),
+
+    .ram = {
+      .read_after_rewrite = { [0 ... VM_SETTING_REGITERS_COUNT-1] = TRUE },
+      .last_write_points = { 0, },
+    },
+  };
+  vm.call_stack[0] = (struct CallFrame) { 0, base_environment };
+  for (size_t i = 0; i < VM_SETTING_REGITERS_COUNT; ++i)
+    vm.registers[i] = modl_nil();
+
+
+  uint64_t std_print_id = vm_add_external_function(&vm, modl_std_print, 1);
+  uint64_t std_concat_id = vm_add_external_function(&vm, modl_std_concat_strings, 2);
+  uint64_t std_to_string_id = vm_add_external_function(&vm, modl_std_to_string, 1);
+  vm_environment_set(&vm, base_environment, str_to_modl("print"), efun_to_modl(std_print_id));
+  vm_environment_set(&vm, base_environment, str_to_modl("concat"), efun_to_modl(std_concat_id));
+  vm_environment_set(&vm, base_environment, str_to_modl("toString"), efun_to_modl(std_to_string_id));
+
+
+  // {
+  //   struct ModlObject * table_efuns = modl_table();
+
+  //   uint64_t std_table_keys_id = vm_add_external_function(&vm, modl_std_table_keys);
+  //   modl_table_insert_kv(table_efuns, str_to_modl("keys"), efun_to_modl(std_table_keys_id));
+
+  //   uint64_t std_table_empty_id = vm_add_external_function(&vm, modl_std_table_empty);
+  //   modl_table_insert_kv(table_efuns, str_to_modl("empty"), efun_to_modl(std_table_empty_id));
+
+  //   uint64_t std_table_pop_id = vm_add_external_function(&vm, modl_std_table_pop);
+  //   modl_table_insert_kv(table_efuns, str_to_modl("pop"), efun_to_modl(std_table_pop_id));
+
+  //   uint64_t std_table_size_id = vm_add_external_function(&vm, modl_std_table_size);
+  //   modl_table_insert_kv(table_efuns, str_to_modl("size"), efun_to_modl(std_table_size_id));
+
+  //   uint64_t std_table_zip_id = vm_add_external_function(&vm, modl_std_table_zip);
+  //   modl_table_insert_kv(table_efuns, str_to_modl("zip"), efun_to_modl(std_table_zip_id));
+
+  //   modl_table_insert_kv(base_environment.vartable, str_to_modl("Table"), table_efuns);
+  // }
+
+  // {
+  //   struct ModlObject * table_efuns = modl_table();
+
+  //   uint64_t std_array_foreach_id = vm_add_external_function(&vm, modl_std_array_foreach);
+  //   modl_table_insert_kv(table_efuns, str_to_modl("forEach"), efun_to_modl(std_array_foreach_id));
+
+  //   uint64_t std_array_map_id = vm_add_external_function(&vm, modl_std_array_map);
+  //   modl_table_insert_kv(table_efuns, str_to_modl("map"), efun_to_modl(std_array_map_id));
+
+  //   uint64_t std_array_map_flat_id = vm_add_external_function(&vm, modl_std_array_map_flat);
+  //   modl_table_insert_kv(table_efuns, str_to_modl("mapFlat"), efun_to_modl(std_array_map_flat_id));
+
+  //   uint64_t std_array_concat_id = vm_add_external_function(&vm, modl_std_array_concat);
+  //   modl_table_insert_kv(table_efuns, str_to_modl("concat"), efun_to_modl(std_array_concat_id));
+
+  //   uint64_t std_array_contains_id = vm_add_external_function(&vm, modl_std_array_contains);
+  //   modl_table_insert_kv(table_efuns, str_to_modl("contains"), efun_to_modl(std_array_contains_id));
+
+  //   modl_table_insert_kv(base_environment.vartable, str_to_modl("Array"), table_efuns);
+  // }
+
+  {
+    struct ModlObject string_efuns = modl_table();
+
+    uint64_t std_string_substring_id = vm_add_external_function(&vm, modl_std_string_substring, 3);
+    modl_table_insert_kv(&string_efuns, str_to_modl("substring"), efun_to_modl(std_string_substring_id));
+
+    uint64_t std_string_to_array_id = vm_add_external_function(&vm, modl_std_string_to_array, 1);
+    modl_table_insert_kv(&string_efuns, str_to_modl("toArray"), efun_to_modl(std_string_to_array_id));
+
+    uint64_t std_string_from_array_id = vm_add_external_function(&vm, modl_std_string_from_array, 1);
+    modl_table_insert_kv(&string_efuns, str_to_modl("fromArray"), efun_to_modl(std_string_from_array_id));
+
+    vm_environment_set(&vm, base_environment, str_to_modl("String"), string_efuns);
+  }
+
+  return vm;
+}
+
+/*!
+ *  \brief Translate bytecode and run it in the base call frame
+ *  \param vm Virtual machine instance
+ *  \param input Raw bytecode
+ *  \param input_length Bytecode length
+ *  \return Result, owned by REG(0)
+ */
+static struct ModlObject vm_execute(struct VMState * vm, byte * input, size_t input_length)
+{
+  struct ConstantPool constants;
+  vm->code = translate_bytecode(input, input_length, &vm->code_length, &constants);
+  vm->constants = constants.objects;
+  vm->constants_count = constants.count;
+  vm->environment_caches = calloc(assign_inline_caches(vm->code, vm->code_length, &vm->table_caches_count) + 1, sizeof (struct EnvironmentCache));
+  vm->table_caches = calloc(vm->table_caches_count + 1, sizeof (struct TableCache));
+  vm->nametables = calloc(vm->code_length, sizeof (struct ModlObject));
+  return run(vm);
+}
+
+/*!
+ *  \brief Release everything held by virtual machine and its base environment
+ *  \param vm Virtual machine instance
+ *  \param base_environment Environment of the base call frame
+ */
+static void vm_destroy(struct VMState * vm, struct Environment * base_environment)
+{
+  for (byte i = 0; i < VM_SETTING_REGITERS_COUNT; ++i)
+    modl_object_release(vm->registers[i]);
+
+  vm_environment_release(base_environment);
+  free(base_environment->variables);
+  for (size_t i = 0; i < vm->code_length; ++i)
+    modl_object_release(vm->nametables[i]);
+  free(vm->nametables);
+  for (size_t i = 0; i < vm->max_count_call_stack; ++i)
+    free(vm->environments[i].variables);
+  free(vm->environments);
+
+  for (size_t i = 0; i < vm->sp; ++i)
+    modl_object_release(vm->stack[i]);
+
+  for (uint32_t i = 0; i < vm->constants_count; ++i)
+    modl_object_release(vm->constants[i]);
+  free(vm->constants);
+  free(vm->code);
+  free(vm->environment_caches);
+  for (uint32_t i = 0; i < vm->table_caches_count; ++i)
+    vm_table_cache_set(&vm->table_caches[i], NULL, NULL, modl_nil(), 0);
+  free(vm->table_caches);
+
+  free(vm->call_stack);
+  free(vm->stack);
+  free(vm->external_functions);
+}
+
+
 #define INPUT_SIZE 1024*1024*1
 int main(int argc, char *argv[])
 {
@@ -1324,6 +2576,8 @@ int main(int argc, char *argv[])
   size_t max_count_call_stack = 64;
   size_t max_count_stack = 128;
   size_t max_count_externals = 128;
+  uint64_t hash_seed = 0;
+  bool has_hash_seed = FALSE;
   double time_spent = 0.0;
 
   clock_t begin = clock();
@@ -1332,10 +2586,13 @@ int main(int argc, char *argv[])
       {"stack_size",      required_argument, 0,  's' },
       {"call_stack_size", required_argument, 0,  'c' },
       {"silent",          no_argument,       0,  'l' },
+      {"stats",           no_argument,       0,  't' },
+      {"incremental_resize", no_argument,    0,  'r' },
+      {"hash_seed",       required_argument, 0,  'e' },
       {0,                 0,                 0,  0   }
   };
 
-  while((opt = getopt_long(argc, argv, ":i:f:s:cl", long_options, &long_index)) != -1)
+  while((opt = getopt_long(argc, argv, ":i:f:s:e:cltr", long_options, &long_index)) != -1)
   {
     switch(opt)
     {
@@ -1403,6 +2660,22 @@ int main(int argc, char *argv[])
         VM_SETTING_SILENT = TRUE;
       } break;
 
+      case 't':
+      {
+        VM_SETTING_STATS = TRUE;
+      } break;
+
+      case 'r':
+      {
+        modl_map_incremental_resize = TRUE;
+      } break;
+
+      case 'e':
+      {
+        hash_seed = strtoull(optarg, NULL, 0);
+        has_hash_seed = TRUE;
+      } break;
+
       case ':':
       {
         printf("option needs a value\n");
@@ -1417,98 +2690,16 @@ int main(int argc, char *argv[])
     }
   }
 
-  // if (VM_RELEASE_QUEUE_SIZE > 0)
-  //   modl_object_release_queue = (struct ModlObject **) calloc(VM_RELEASE_QUEUE_SIZE, sizeof (struct ModlObject *));
-
-  struct Environment base_environment = { NULL, modl_table_new() };
-  struct VMState vm =
-  {
-    .code = NULL,
-
-    .max_count_call_stack = max_count_call_stack,
-    .max_count_stack = max_count_stack,
-    .max_count_externals = 16,
-
-    .ip = 0, .csp = 0, .sp = 0, .efc = 0,
-    .call_stack = (struct CallFrame *) malloc(max_count_call_stack * sizeof (struct CallFrame)),
-    .registers = { },
-    .stack = (struct ModlObject *) (malloc(max_count_stack * sizeof (struct ModlObject))),
-    .external_functions = (struct ModlObject (**)(struct VMState*))(malloc(max_count_externals*sizeof(struct ModlObject (**)(struct VMState*)))),
-
-    .ram = {
-      .read_after_rewrite = { [0 ... VM_SETTING_REGITERS_COUNT-1] = TRUE },
-      .last_write_points = { 0, },
-    },
-  };
-  vm.call_stack[0] = (struct CallFrame) { 0, &base_environment };
-  for (size_t i = 0; i < VM_SETTING_REGITERS_COUNT; ++i)
-    vm.registers[i] = modl_nil();
-
-
-  uint64_t std_print_id = vm_add_external_function(&vm, modl_std_print);
-  uint64_t std_concat_id = vm_add_external_function(&vm, modl_std_concat_strings);
-  uint64_t std_to_string_id = vm_add_external_function(&vm, modl_std_to_string);
-  modl_table_insert_kv(&base_environment.vartable, str_to_modl("print"), efun_to_modl(std_print_id));
-  modl_table_insert_kv(&base_environment.vartable, str_to_modl("concat"), efun_to_modl(std_concat_id));
-  modl_table_insert_kv(&base_environment.vartable, str_to_modl("toString"), efun_to_modl(std_to_string_id));
-
-
-  // {
-  //   struct ModlObject * table_efuns = modl_table();
-
-  //   uint64_t std_table_keys_id = vm_add_external_function(&vm, modl_std_table_keys);
-  //   modl_table_insert_kv(table_efuns, str_to_modl("keys"), efun_to_modl(std_table_keys_id));
-
-  //   uint64_t std_table_empty_id = vm_add_external_function(&vm, modl_std_table_empty);
-  //   modl_table_insert_kv(table_efuns, str_to_modl("empty"), efun_to_modl(std_table_empty_id));
-
-  //   uint64_t std_table_pop_id = vm_add_external_function(&vm, modl_std_table_pop);
-  //   modl_table_insert_kv(table_efuns, str_to_modl("pop"), efun_to_modl(std_table_pop_id));
-
-  //   uint64_t std_table_size_id = vm_add_external_function(&vm, modl_std_table_size);
-  //   modl_table_insert_kv(table_efuns, str_to_modl("size"), efun_to_modl(std_table_size_id));
-
-  //   uint64_t std_table_zip_id = vm_add_external_function(&vm, modl_std_table_zip);
-  //   modl_table_insert_kv(table_efuns, str_to_modl("zip"), efun_to_modl(std_table_zip_id));
-
-  //   modl_table_insert_kv(base_environment.vartable, str_to_modl("Table"), table_efuns);
-  // }
-
-  // {
-  //   struct ModlObject * table_efuns = modl_table();
-
-  //   uint64_t std_array_foreach_id = vm_add_external_function(&vm, modl_std_array_foreach);
-  //   modl_table_insert_kv(table_efuns, str_to_modl("forEach"), efun_to_modl(std_array_foreach_id));
-
-  //   uint64_t std_array_map_id = vm_add_external_function(&vm, modl_std_array_map);
-  //   modl_table_insert_kv(table_efuns, str_to_modl("map"), efun_to_modl(std_array_map_id));
-
-  //   uint64_t std_array_map_flat_id = vm_add_external_function(&vm, modl_std_array_map_flat);
-  //   modl_table_insert_kv(table_efuns, str_to_modl("mapFlat"), efun_to_modl(std_array_map_flat_id));
-
-  //   uint64_t std_array_concat_id = vm_add_external_function(&vm, modl_std_array_concat);
-  //   modl_table_insert_kv(table_efuns, str_to_modl("concat"), efun_to_modl(std_array_concat_id));
-
-  //   uint64_t std_array_contains_id = vm_add_external_function(&vm, modl_std_array_contains);
-  //   modl_table_insert_kv(table_efuns, str_to_modl("contains"), efun_to_modl(std_array_contains_id));
-
-  //   modl_table_insert_kv(base_environment.vartable, str_to_modl("Array"), table_efuns);
-  // }
-
-  {
-    struct ModlObject string_efuns = modl_table();
-
-    uint64_t std_string_substring_id = vm_add_external_function(&vm, modl_std_string_substring);
-    modl_table_insert_kv(&string_efuns, str_to_modl("substring"), efun_to_modl(std_string_substring_id));
-
-    uint64_t std_string_to_array_id = vm_add_external_function(&vm, modl_std_string_to_array);
-    modl_table_insert_kv(&string_efuns, str_to_modl("toArray"), efun_to_modl(std_string_to_array_id));
+  /* objects cache their hashes, the seed is fixed before any is made */
+  modl_object_set_hash_seed(has_hash_seed ? hash_seed : vm_random_seed());
 
-    uint64_t std_string_from_array_id = vm_add_external_function(&vm, modl_std_string_from_array);
-    modl_table_insert_kv(&string_efuns, str_to_modl("fromArray"), efun_to_modl(std_string_from_array_id));
+  if (VM_RELEASE_QUEUE_SIZE > 0)
+    modl_object_release_queue_init(VM_RELEASE_QUEUE_SIZE);
+  if (VM_SETTING_CYCLE_CANDIDATES > 0)
+    modl_collector_init(VM_SETTING_CYCLE_CANDIDATES);
 
-    modl_table_insert_kv(&base_environment.vartable, str_to_modl("String"), string_efuns);
-  }
+  struct Environment base_environment = { .nametable = modl_table_new() };
+  struct VMState vm = vm_create(&base_environment, max_count_call_stack, max_count_stack, max_count_externals);
 
 
   // struct BytecodeCompiler bcc = { (enum ModlOpcode*) calloc(16, sizeof(byte)), 0 };
@@ -1546,9 +2737,7 @@ int main(int argc, char *argv[])
     printf("\x1b[34;1m%s\x1b[0m\n",   "-----=====      RUN       =====-----");
   }
 
-  vm.code = input;
-  decoded_sebo_table = (struct Sebo *) calloc(input_length, sizeof (struct Sebo));
-  struct ModlObject result = run(&vm);
+  struct ModlObject result = vm_execute(&vm, input, input_length);
 
   if (not VM_SETTING_SILENT)
     printf("\n\x1b[34;1m%s\x1b[0m\n", "-----=====     RESULT     =====-----");
@@ -1556,17 +2745,49 @@ int main(int argc, char *argv[])
   modl_object_display(&result);
   printf("%c", '\n');
 
-  for (byte i = 0; i < VM_SETTING_REGITERS_COUNT; ++i)
-    modl_object_release(vm.registers[i]);
+  vm_destroy(&vm, &base_environment);
 
-  modl_object_release(base_environment.vartable);
+  /* cycles left once everything else is released are garbage */
+  modl_object_release_pending(SIZE_MAX);
+  if (modl_collector_is_enabled()) modl_collector_collect();
+  modl_collector_free();
+  modl_object_release_queue_free();
 
-  for (size_t i = 0; i < vm.sp; ++i)
-    modl_object_release(vm.stack[i]);
+  if (VM_SETTING_STATS)
+  {
+    printf("\n%s\n", "stats:");
+    printf("  environment cache: hits=%" PRIu64 " misses=%" PRIu64 "\n",
+      vm.environment_cache_hits, vm.environment_cache_misses);
+    printf("  table cache: hits=%" PRIu64 " misses=%" PRIu64 "\n",
+      vm.table_cache_hits, vm.table_cache_misses);
+    printf("  quickening: rewrites=%" PRIu64 " deoptimizations=%" PRIu64 "\n",
+      vm.quickenings, vm.deoptimizations);
+    printf("  tail calls: %" PRIu64 "\n", vm.tail_calls);
+
+    struct ModlPoolStats pool;
+    modl_pool_stats(&pool);
+    struct ModlReleaseStats releases;
+    modl_object_release_queue_stats(&releases);
+    printf("  deferred releases: tables=%zu max_pending=%zu entries=%zu\n",
+      releases.queued, releases.max_pending, releases.released);
+    struct ModlCollectorStats collector;
+    modl_collector_stats(&collector);
+    printf("  cycle collector: collections=%zu candidates=%zu collected=%zu pause: total=%" PRIu64 "us max=%" PRIu64 "us\n",
+      collector.collections, collector.candidates, collector.collected, collector.total_pause, collector.max_pause);
+    printf("  regions: begun=%zu reset=%zu deferred=%zu chunks=%zu promotions=%" PRIu64 "\n",
+      pool.regions, pool.region_resets, pool.region_deferred, pool.region_chunks, vm.region_promotions);
+    printf("  object pool: large strings=%zu\n", pool.large_allocations);
+    for (size_t i = 0; i < MODL_POOL_CLASSES; ++i)
+    {
+      struct ModlPoolClassStats const * class = &pool.classes[i];
+      printf("    %s %3zu bytes: allocations=%zu slabs=%zu slots=%zu used=%zu free=%zu (%.1f%%)\n",
+        0 == i ? "references" : "strings   ", class->slot_size, class->allocations, class->slabs,
+        class->slots, class->used, class->slots - class->used,
+        0 == class->slots ? 0.0 : 100.0 * (class->slots - class->used) / class->slots);
+    }
+  }
 
-  free(vm.call_stack);
-  free(vm.stack);
-  free(vm.external_functions);
+  modl_pool_release_all();
 
   clock_t end = clock();
   time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
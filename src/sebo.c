@@ -53,33 +53,30 @@ struct Sebo modl_decode_sebo(byte * data)
     }
     case 0x06:
     {
-      char * value;
       struct Sebo const length = modl_decode_sebo(data + 1);
       size_t length_i = (size_t) modl_to_int(length.object);
       modl_object_release_tmp(length.object);
 
-      value = (char *) malloc(length_i + 1);
-      memcpy(value, data + 1 + length.byte_length, length_i);
-      value[length_i] = (byte) 0x00;
-
-      struct ModlObject obj = str_to_modl(value);
-      free(value);
+      char const * value = (char const *) data + 1 + length.byte_length;
+      struct ModlObject obj = str_to_modl_n(value, strnlen(value, length_i));
 
       return (struct Sebo) { data, 1 + length.byte_length + length_i, obj };
     }
     case 0x0A:
     {
+      /* table constants are empty, the length is the number of values the
+         literal pushes and only reserves room for them */
       struct Sebo const length = modl_decode_sebo(data + 1);
-      if (modl_to_int(length.object) > 0)
+      if (modl_to_int(length.object) < 0)
       {
-        printf("\x1b[31;1m  %s: %s\x1b[0m\n", "failed to decode modl object", "table is not empty");
+        printf("\x1b[31;1m  %s: %s\x1b[0m\n", "failed to decode modl object", "table length is negative");
         exit(EXIT_FAILURE);
       }
 
-      // size_t length_i = (size_t) modl_to_int(length.object);
+      size_t length_i = (size_t) modl_to_int(length.object);
       modl_object_release_tmp(length.object);
 
-      return (struct Sebo) { data, 1 + length.byte_length, modl_table() };
+      return (struct Sebo) { data, 1 + length.byte_length, modl_table_with_capacity(length_i, 0) };
     }
 
     default:
@@ -97,10 +94,10 @@ static byte array_of__2[] = { 2 };
 
 struct Sebo modl_encode_sebo(struct ModlObject object)
 {
-  switch (object.type)
+  switch (modl_object_type(object))
   {
     case ModlTypeNil: return (struct Sebo) { array_of__0, 1, object };
-    case ModlTypeBoolean: return (struct Sebo) { object.value.boolean ? array_of__2 : array_of__1, 1, object };
+    case ModlTypeBoolean: return (struct Sebo) { modl_to_bool(object) ? array_of__2 : array_of__1, 1, object };
     case ModlTypeInteger:
     {
       uint64_t value = (uint64_t) modl_to_int(object);
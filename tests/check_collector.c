@@ -0,0 +1,68 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include <src/collector.h>
+#include <src/object.h>
+#include <src/pool.h>
+
+
+int test_collector()
+{
+    TEST("collector")
+    {
+        TEST("cycles")
+        {
+            struct ModlPoolStats before, after;
+            modl_pool_stats(&before);
+            modl_collector_init(16);
+
+            /* a table referring to itself and a parent/child pair */
+            struct ModlObject self = modl_table_new();
+            modl_table_insert_kv(&self, str_to_modl("__index"), self);
+            struct ModlObject parent = modl_table_new();
+            struct ModlObject child = modl_table();
+            modl_table_insert_kv(&parent, str_to_modl("child"), child);
+            modl_table_insert_kv(&child, str_to_modl("parent"), parent);
+            modl_table_push_v(&child, str_to_modl("leaf"));
+
+            /* a pair kept alive by a reference from outside */
+            struct ModlObject holder = modl_table_new();
+            struct ModlObject a = modl_table();
+            struct ModlObject b = modl_table();
+            modl_table_insert_kv(&a, str_to_modl("b"), b);
+            modl_table_insert_kv(&b, str_to_modl("a"), a);
+            modl_table_push_v(&holder, a);
+
+            modl_object_release(self);
+            modl_object_release(parent);
+            EXPECT(2 <= modl_collector_candidates(), "released tables are candidates");
+
+            EXPECT(3 == modl_collector_collect(), "unreachable cycles are collected");
+            EXPECT(0 == modl_collector_candidates(), "collection empties the buffer");
+            EXPECT(2 == modl_object_get_reference_count(a) && 1 == modl_object_get_reference_count(b),
+                   "counts of live tables are restored");
+
+            modl_object_release(holder);
+            EXPECT(2 == modl_collector_collect(), "cycle is collected once its holder is gone");
+
+            struct ModlCollectorStats stats;
+            modl_collector_stats(&stats);
+            EXPECT(2 <= stats.collections && 5 <= stats.collected, "collections are counted");
+
+            /* a buffered table that dies leaves the buffer */
+            struct ModlObject dying = modl_table_new();
+            struct ModlObject other = modl_object_take(dying);
+            modl_object_release(dying);
+            modl_object_release(other);
+            EXPECT(0 == modl_collector_candidates(), "dead table is no longer a candidate");
+
+            modl_collector_free();
+            modl_pool_stats(&after);
+            EXPECT(after.classes[0].used == before.classes[0].used, "no table is left behind");
+        } END_TEST;
+    } END_TEST;
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test.h"
+#include <src/object.h>
+#include <src/object_reference.h>
+
+
+/* string hash used before modl_string_hash, kept as the baseline */
+#define get16bits(d) ((((uint32_t)(((const uint8_t *)(d))[1])) << 8)\
+                       +(uint32_t)(((const uint8_t *)(d))[0]) )
+
+static uint32_t legacy_str_hash(char const * data, size_t len)
+{
+    uint32_t hash = len, tmp;
+    int rem;
+
+    if (0 == len || NULL == data) return 0;
+
+    rem = len & 3;
+    len >>= 2;
+
+    for (;len > 0; len--) {
+        hash  += get16bits (data);
+        tmp    = (get16bits (data+2) << 11) ^ hash;
+        hash   = (hash << 16) ^ tmp;
+        data  += 2*sizeof (uint16_t);
+        hash  += hash >> 11;
+    }
+
+    switch (rem) {
+        case 3: hash += get16bits (data);
+                hash ^= hash << 16;
+                hash ^= ((signed char)data[sizeof (uint16_t)]) << 18;
+                hash += hash >> 11;
+                break;
+        case 2: hash += get16bits (data);
+                hash ^= hash << 11;
+                hash += hash >> 17;
+                break;
+        case 1: hash += (signed char)*data;
+                hash ^= hash << 10;
+                hash += hash >> 1;
+    }
+
+    hash ^= hash << 3;
+    hash += hash >> 5;
+    hash ^= hash << 4;
+    hash += hash >> 17;
+    hash ^= hash << 25;
+    hash += hash >> 6;
+
+    return hash;
+}
+
+#undef get16bits
+
+
+static double seconds_since(clock_t begin)
+{
+    return (double) (clock() - begin) / CLOCKS_PER_SEC;
+}
+
+int test_hash()
+{
+    TEST("hash")
+    {
+        TEST("string hash")
+        {
+            char const * a = "0000000000000000000000000000000000000000000000000000000000000000";
+            char b[65];
+            strcpy(b, a);
+
+            EXPECT(modl_string_hash(a, 64) == modl_string_hash(b, 64), "equal strings hash equally");
+            EXPECT(modl_string_hash(a, 64) != modl_string_hash(a, 63), "prefix hashes differently");
+
+            int differ = 1;
+            for (int i = 0; i < 64; ++i)
+            {
+                b[i] = '1';
+                differ &= modl_string_hash(a, 64) != modl_string_hash(b, 64);
+                b[i] = '0';
+            }
+            EXPECT(differ, "every byte changes the hash");
+
+            struct ModlObject str = str_to_modl(a);
+            EXPECT(modl_object_hash(str) == modl_string_hash(a, 64), "strings are hashed with their length");
+            modl_object_release_tmp(str);
+
+            /* the stored length is used, not the one up to a null character */
+            struct ModlObject nul = str_to_modl_n("ab\0cd", 5);
+            modl_to_ref(nul)->has_hash = FALSE;
+            EXPECT(5 == modl_to_ref(nul)->string_length && modl_object_hash(nul) == modl_string_hash("ab\0cd", 5),
+                   "strings keep their length for hashing");
+            modl_object_release_tmp(nul);
+        } END_TEST;
+
+        TEST("string hash speed")
+        {
+            static size_t const lengths[] = { 4, 8, 16, 32, 64, 128, 1024 };
+            size_t const bytes = 64 * 1024 * 1024;
+            char * data = malloc(1024 + 8);
+            for (size_t i = 0; i < 1024 + 8; ++i)
+                data[i] = 'a' + i % 26;
+
+            for (size_t l = 0; l < sizeof lengths / sizeof lengths[0]; ++l)
+            {
+                size_t const length = lengths[l];
+                size_t const rounds = bytes / length;
+                volatile uint32_t sink = 0;
+
+                clock_t begin = clock();
+                for (size_t i = 0; i < rounds; ++i)
+                    sink += legacy_str_hash(data + (i & 7), length);
+                double const legacy = seconds_since(begin);
+
+                begin = clock();
+                for (size_t i = 0; i < rounds; ++i)
+                    sink += modl_string_hash(data + (i & 7), length);
+                double const current = seconds_since(begin);
+
+                INFO_MANUAL(printf("length %4zu: legacy %.3f s, modl_string_hash %.3f s per 64 MiB", length, legacy, current));
+            }
+
+            free(data);
+            PASS("measured");
+        } END_TEST;
+    } END_TEST;
+
+    return 0;
+}
@@ -55,25 +55,20 @@ int test_map()
                 values[i] = int_to_modl(rand());
             }
 
+            /* keys repeat, so a later value may replace an earlier one */
+            int found = 1;
             for (size_t i = 0; i < TEST_ENTRIES_COUNT; ++i)
             {
-                // modl_table_insert_kv(table, keys[i], values[i]);
-                // const int entry_found = modl_object_equals(modl_table_get_v(table, keys[i]), values[i]);
                 modl_map_set(map, keys[i], values[i]);
-                // modl_map_print(map);
-                // printf("\n");
                 struct ModlObject * entry = modl_map_get(map, keys[i]);
-                // EXPECT(NULL != entry);
-                const int entry_found = modl_object_equals(*entry, values[i]);
-                // EXPECT(entry_found);
+                found &= NULL != entry && modl_object_equals(*entry, values[i]);
             }
+            EXPECT(found, "inserted entry is found right away");
 
+            found = 1;
             for (size_t i = 0; i < TEST_ENTRIES_COUNT; ++i)
-            {
-                const int entry_found = modl_object_equals(*modl_map_get(map, keys[i]), values[i]);
-                // const int entry_found = modl_object_equals(modl_table_get_v(table, keys[i]), values[i]);
-                // EXPECT(entry_found);
-            }
+                found &= NULL != modl_map_get(map, keys[i]);
+            EXPECT(found, "every inserted key is found");
 
             for (size_t i = 0; i < TEST_ENTRIES_COUNT; ++i)
             {
@@ -84,13 +79,432 @@ int test_map()
             free(keys);
             free(values);
         } END_TEST;
+        TEST("remove / reinsert")
+        {
+            struct ModlMap m;
+            modl_map_init(&m, 0);
+            EXPECT(0 == m.capacity, "empty map allocates nothing");
+
+            const int64_t N = 4096;
+            for (int64_t i = 0; i < N; ++i)
+                modl_map_set(&m, int_to_modl(i), int_to_modl(2 * i));
+
+            int removed = 1;
+            for (int64_t i = 0; i < N; i += 2)
+                removed &= modl_map_remove(&m, int_to_modl(i));
+            EXPECT(removed, "every even key was removed");
+            EXPECT(N / 2 == m.size, "size counts remaining entries");
+            EXPECT(!modl_map_remove(&m, int_to_modl(0)), "removed key cannot be removed again");
+
+            int consistent = 1;
+            for (int64_t i = 0; i < N; ++i)
+            {
+                struct ModlObject * entry = modl_map_get(&m, int_to_modl(i));
+                consistent &= (i % 2) ? NULL != entry && 2 * i == modl_to_int(*entry) : NULL == entry;
+            }
+            EXPECT(consistent, "odd keys are kept and even keys are gone");
+
+            for (int64_t i = 0; i < N; i += 2)
+                modl_map_set(&m, int_to_modl(i), int_to_modl(-i));
+
+            consistent = N == m.size;
+            for (int64_t i = 0; i < N; ++i)
+            {
+                struct ModlObject * entry = modl_map_get(&m, int_to_modl(i));
+                consistent &= NULL != entry && ((i % 2) ? 2 * i : -i) == modl_to_int(*entry);
+            }
+            EXPECT(consistent, "reinserted keys reuse deleted slots");
+
+            modl_map_dispose(&m);
+        } END_TEST;
+
+        TEST("array part")
+        {
+            struct ModlMap m;
+            modl_map_init(&m, 0);
+
+            for (int64_t i = 0; i < 1000; ++i)
+                modl_map_push(&m, int_to_modl(i));
+            EXPECT(1000 == m.array_size && 1000 == m.size, "pushed values go to the array part");
+
+            /* keys inserted out of order join the array once the gap closes */
+            for (int64_t i = 1999; i > 1000; --i)
+                modl_map_set(&m, int_to_modl(i), int_to_modl(i));
+            EXPECT(1000 == m.array_size, "keys after a gap stay in the hash part");
+            modl_map_set(&m, int_to_modl(1000), int_to_modl(1000));
+            EXPECT(2000 == m.array_size && 2000 == m.size, "closing the gap moves keys to the array part");
+
+            EXPECT(modl_map_remove(&m, int_to_modl(1500)), "key in the middle of the array is removed");
+            EXPECT(2000 == m.array_size && 1999 == m.size, "removed key leaves a hole in the array part");
+            EXPECT(!modl_map_remove(&m, int_to_modl(1500)), "hole cannot be removed again");
+
+            int consistent = 1;
+            for (int64_t i = 0; i < 2000; ++i)
+            {
+                struct ModlObject * entry = modl_map_get(&m, int_to_modl(i));
+                consistent &= 1500 == i ? NULL == entry : NULL != entry && i == modl_to_int(*entry);
+            }
+            EXPECT(consistent, "all other keys are still found");
+
+            modl_map_set(&m, int_to_modl(1500), int_to_modl(1500));
+            EXPECT(2000 == m.size && NULL != modl_map_get(&m, int_to_modl(1500)), "hole is filled again");
+
+            modl_map_dispose(&m);
+        } END_TEST;
+
+        TEST("removing from the front")
+        {
+            struct ModlMap m;
+            modl_map_init(&m, 0);
+
+            const int64_t N = 100000;
+            for (int64_t i = 0; i < N; ++i)
+                modl_map_push(&m, int_to_modl(i));
+            uint32_t const array_capacity = m.array_capacity;
+
+            /* a queue drops keys at the front, the rest keep their place */
+            int64_t const kept = N / MODL_MAP_SHRINK_RATIO;
+            for (int64_t i = 0; i < N - kept; ++i)
+                modl_map_remove(&m, int_to_modl(i));
+            EXPECT(N == m.array_size && N - kept == m.array_holes && kept == m.size, "removed keys leave holes");
+            EXPECT(0 == m.capacity && array_capacity == m.array_capacity, "nothing moves to the hash part");
+
+            int consistent = NULL == modl_map_get(&m, int_to_modl(0));
+            for (int64_t i = N - kept; i < N; ++i)
+            {
+                struct ModlObject * entry = modl_map_get(&m, int_to_modl(i));
+                consistent &= NULL != entry && i == modl_to_int(*entry);
+            }
+            EXPECT(consistent, "remaining keys are found in the array part");
+
+            uint64_t cursor = 0;
+            struct ModlObject key, val;
+            int64_t first = -1, count = 0;
+            while (modl_map_next(&m, &cursor, &key, &val))
+            {
+                if (0 == count++)
+                    first = modl_to_int(key);
+            }
+            EXPECT(N - kept == first && kept == count, "iteration skips the holes");
+
+            modl_map_push(&m, int_to_modl(N));
+            EXPECT(N + 1 == m.array_size && kept + 1 == m.size, "push appends after the holes");
+
+            /* once the array part is mostly holes its keys move to the hash part */
+            modl_map_remove(&m, int_to_modl(N - kept));
+            modl_map_remove(&m, int_to_modl(N - kept + 1));
+            EXPECT(0 == m.array_size && NULL == m.array && 0 != m.capacity && kept - 1 == m.size,
+                   "sparse array part moves to the hash part");
+
+            consistent = 1;
+            for (int64_t i = N - kept + 2; i <= N; ++i)
+            {
+                struct ModlObject * entry = modl_map_get(&m, int_to_modl(i));
+                consistent &= NULL != entry && i == modl_to_int(*entry);
+            }
+            EXPECT(consistent, "moved keys are found in the hash part");
+
+            modl_map_dispose(&m);
+        } END_TEST;
+
+        TEST("shrinking")
+        {
+            struct ModlMap m;
+            modl_map_init(&m, 0);
+
+            for (int64_t i = 0; i < 10000; ++i)
+            {
+                modl_map_push(&m, int_to_modl(i));
+                modl_map_set(&m, int_to_modl(-i - 1), int_to_modl(i));
+            }
+            uint32_t const capacity = m.capacity;
+            uint32_t const array_capacity = m.array_capacity;
+
+            for (int64_t i = 9999; i >= 10; --i)
+            {
+                modl_map_remove(&m, int_to_modl(i));
+                modl_map_remove(&m, int_to_modl(-i - 1));
+            }
+            EXPECT(m.array_capacity < array_capacity / 64, "array part shrinks on removal");
+            EXPECT(m.capacity < capacity / 64, "hash part shrinks on removal");
+
+            int consistent = 20 == m.size && 10 == m.array_size;
+            for (int64_t i = 0; i < 10; ++i)
+            {
+                struct ModlObject * entry = modl_map_get(&m, int_to_modl(-i - 1));
+                consistent &= NULL != entry && i == modl_to_int(*entry);
+            }
+            EXPECT(consistent, "remaining entries are kept");
+
+            for (int64_t i = 0; i < 10; ++i)
+                modl_map_remove(&m, int_to_modl(-i - 1));
+            EXPECT(0 == m.capacity, "empty hash part is released");
+
+            modl_map_dispose(&m);
+        } END_TEST;
+
+        TEST("iteration")
+        {
+            struct ModlMap m;
+            modl_map_init(&m, 0);
+
+            const int64_t N = 3000;
+            for (int64_t i = 0; i < N; ++i)
+            {
+                modl_map_push(&m, int_to_modl(1));
+                modl_map_set(&m, int_to_modl(-i - 1), int_to_modl(1));
+            }
+
+            /* count visits in the values, removing every other entry */
+            uint64_t cursor = 0;
+            struct ModlObject key, val;
+            int64_t visited = 0;
+            while (modl_map_next(&m, &cursor, &key, &val))
+            {
+                visited += 1;
+                if (visited % 2)
+                    modl_map_remove(&m, key);
+                else
+                    modl_map_set(&m, key, int_to_modl(modl_to_int(val) + 1));
+            }
+            EXPECT(2 * N == visited, "every entry is visited once while removing");
+
+            int consistent = N == m.size;
+            cursor = 0;
+            while (modl_map_next(&m, &cursor, &key, &val))
+                consistent &= 2 == modl_to_int(val);
+            EXPECT(consistent, "updated entries are kept");
+
+            /* removals that leave the map sparse shrink it after the iteration */
+            uint32_t const capacity = m.capacity;
+            cursor = 0;
+            visited = 0;
+            while (modl_map_next(&m, &cursor, &key, &val))
+            {
+                visited += 1;
+                if (visited % 8)
+                    modl_map_remove(&m, key);
+            }
+            EXPECT(N == visited, "every entry is visited once while most are removed");
+            EXPECT(N / 8 == m.size && m.capacity < capacity, "map shrinks once the iteration ends");
+
+            modl_map_dispose(&m);
+        } END_TEST;
+
+        TEST("incremental resize")
+        {
+            struct ModlMap m;
+            modl_map_init(&m, 0);
+            m.incremental = TRUE;
+
+            /* negative keys stay out of the array part */
+            const int64_t N = 10000;
+            int migrating = 0;
+            for (int64_t i = 1; i <= N; ++i)
+            {
+                modl_map_set(&m, int_to_modl(-i), int_to_modl(i));
+                migrating |= NULL != m.resize;
+            }
+            EXPECT(migrating, "entries were moved over several inserts");
+
+            int removed = 1;
+            for (int64_t i = 1; i <= N; i += 3)
+                removed &= modl_map_remove(&m, int_to_modl(-i));
+            EXPECT(removed, "entries are removed from old and new slots");
+
+            int consistent = 1;
+            for (int64_t i = 1; i <= N; ++i)
+            {
+                struct ModlObject * entry = modl_map_get(&m, int_to_modl(-i));
+                consistent &= (1 == i % 3) ? NULL == entry : NULL != entry && i == modl_to_int(*entry);
+            }
+            EXPECT(consistent, "every remaining key is found");
+            EXPECT(NULL == m.resize, "old slots are released once moved");
+
+            modl_map_dispose(&m);
+        } END_TEST;
+
+        TEST("string keys")
+        {
+            struct ModlMap m;
+            modl_map_init(&m, 4);
+            char name[32];
+            for (int i = 0; i < 1000; ++i)
+            {
+                sprintf(name, "key-%d", i);
+                modl_map_set(&m, str_to_modl(name), int_to_modl(i));
+            }
+
+            int consistent = 1000 == m.size;
+            for (int i = 0; i < 1000; ++i)
+            {
+                sprintf(name, "key-%d", i);
+                struct ModlObject key = str_to_modl(name);
+                struct ModlObject * entry = modl_map_get(&m, key);
+                consistent &= NULL != entry && i == modl_to_int(*entry);
+                modl_object_release_tmp(key);
+            }
+            EXPECT(consistent, "every string key is found");
+
+            modl_map_dispose(&m);
+        } END_TEST;
+
+        TEST("reserve / bulk insert")
+        {
+            struct ModlMap m;
+            modl_map_init(&m, 0);
+            modl_map_reserve(&m, 100, 1000);
+
+            uint32_t const capacity = m.capacity;
+            struct ModlObject const * const array = m.array;
+            for (int64_t i = 0; i < 1000; ++i)
+                modl_map_set(&m, int_to_modl(-i - 1), int_to_modl(i));
+            for (int64_t i = 0; i < 100; ++i)
+                modl_map_push(&m, int_to_modl(i));
+            EXPECT(capacity == m.capacity && array == m.array, "reserved entries fit without reallocation");
+            modl_map_dispose(&m);
+
+            const size_t N = 1000;
+            struct ModlObject * keys = malloc(N * sizeof (struct ModlObject));
+            struct ModlObject * values = malloc(N * sizeof (struct ModlObject));
+            for (size_t i = 0; i < N; ++i)
+            {
+                keys[i] = int_to_modl(i % 2 ? (int64_t) i / 2 : -(int64_t) i - 1);
+                values[i] = int_to_modl(i);
+            }
+
+            struct ModlObject table = modl_table_new();
+            modl_table_insert_all(&table, keys, values, N);
+
+            int consistent = N == modl_to_ref(table)->value.table.size && N / 2 == modl_table_length(&table);
+            for (size_t i = 0; i < N; ++i)
+                consistent &= modl_object_equals(modl_table_get_v(&table, keys[i]), values[i]);
+            EXPECT(consistent, "bulk inserted entries are found");
+
+            modl_object_release(table);
+            free(keys);
+            free(values);
+        } END_TEST;
+
+        TEST("key specialization")
+        {
+            struct ModlMap m;
+            modl_map_init(&m, 0);
+
+            for (int64_t i = 1; i <= 100; ++i)
+                modl_map_set(&m, int_to_modl(-i), int_to_modl(i));
+            EXPECT(ModlMapKeysInteger == m.keys, "integer keys are compared as integers");
+
+            struct ModlObject name = str_to_modl("name");
+            EXPECT(NULL == modl_map_get(&m, name), "string key misses an integer map");
+
+            modl_map_set(&m, name, int_to_modl(0));
+            EXPECT(ModlMapKeysGeneric == m.keys, "key of another type makes the map generic");
+
+            int consistent = NULL != modl_map_get(&m, name);
+            for (int64_t i = 1; i <= 100; ++i)
+            {
+                struct ModlObject * entry = modl_map_get(&m, int_to_modl(-i));
+                consistent &= NULL != entry && i == modl_to_int(*entry);
+            }
+            EXPECT(consistent, "generic map finds keys of both types");
+
+            modl_object_release_tmp(name);
+            modl_map_dispose(&m);
+        } END_TEST;
+
+        TEST("shapes")
+        {
+            struct ModlMap a, b, c;
+            modl_map_init(&a, 0);
+            modl_map_init(&b, 0);
+            modl_map_init(&c, 0);
+            modl_map_use_shapes(&a);
+            modl_map_use_shapes(&b);
+            modl_map_use_shapes(&c);
+
+            struct ModlObject x = str_to_modl("x");
+            struct ModlObject y = str_to_modl("y");
+            modl_map_set(&a, x, int_to_modl(1));
+            modl_map_set(&a, y, int_to_modl(2));
+            modl_map_set(&b, x, int_to_modl(3));
+            modl_map_set(&b, y, int_to_modl(4));
+            modl_map_set(&c, y, int_to_modl(5));
+            modl_map_set(&c, x, int_to_modl(6));
+            EXPECT(NULL != modl_map_shape(&a) && modl_map_shape(&a) == modl_map_shape(&b), "same keys in the same order share a shape");
+            EXPECT(modl_map_shape(&a) != modl_map_shape(&c), "another order makes another shape");
+            EXPECT(0 == a.capacity && 2 == a.size, "fields do not use the hash part");
+
+            struct ModlObject other_y = str_to_modl("y");
+            struct ModlObject * entry = modl_map_get(&b, other_y);
+            EXPECT(NULL != entry && 4 == modl_to_int(*entry), "field is found by an equal key");
+
+            struct ModlShape * const shape = modl_map_shape(&b);
+            modl_map_remove(&b, x);
+            uint64_t cursor = 0;
+            struct ModlObject key, val;
+            int count = 0;
+            while (modl_map_next(&b, &cursor, &key, &val))
+                ++count;
+            EXPECT(shape == modl_map_shape(&b) && 1 == b.size && NULL == modl_map_get(&b, x) && 1 == count,
+                   "removed key stays in the shape, unbound");
+
+            modl_map_set(&b, x, int_to_modl(7));
+            entry = modl_map_get(&b, x);
+            EXPECT(shape == modl_map_shape(&b) && NULL != entry && 7 == modl_to_int(*entry), "unbound field is set again");
+
+            modl_map_set(&c, int_to_modl(-1), int_to_modl(8));
+            entry = modl_map_get(&c, other_y);
+            EXPECT(NULL == modl_map_shape(&c) && 3 == c.size && NULL != entry && 5 == modl_to_int(*entry),
+                   "key of another type moves the fields to the hash part");
+
+            char name[32];
+            for (int i = 0; i <= MODL_SHAPE_MAX_FIELDS; ++i)
+            {
+                sprintf(name, "field-%d", i);
+                modl_map_set(&a, str_to_modl(name), int_to_modl(i));
+            }
+            int consistent = NULL == modl_map_shape(&a) && MODL_SHAPE_MAX_FIELDS + 3 == a.size;
+            for (int i = 0; i <= MODL_SHAPE_MAX_FIELDS; ++i)
+            {
+                sprintf(name, "field-%d", i);
+                struct ModlObject field = str_to_modl(name);
+                entry = modl_map_get(&a, field);
+                consistent &= NULL != entry && i == modl_to_int(*entry);
+                modl_object_release_tmp(field);
+            }
+            EXPECT(consistent, "too many keys move the fields to the hash part");
+
+            modl_object_release_tmp(other_y);
+            modl_map_dispose(&a);
+            modl_map_dispose(&b);
+            modl_map_dispose(&c);
+        } END_TEST;
+
+        TEST("seeded hashes")
+        {
+            modl_object_set_hash_seed(1);
+            uint32_t const int_a = modl_object_hash(int_to_modl(1 << 20));
+            struct ModlObject str_a = str_to_modl("transaction");
+            modl_object_set_hash_seed(2);
+            uint32_t const int_b = modl_object_hash(int_to_modl(1 << 20));
+            struct ModlObject str_b = str_to_modl("transaction");
+            modl_object_set_hash_seed(0);
+
+            EXPECT(int_a != int_b, "integer hash depends on the seed");
+            EXPECT(modl_object_hash(str_a) != modl_object_hash(str_b), "string hash depends on the seed");
+
+            modl_object_release_tmp(str_a);
+            modl_object_release_tmp(str_b);
+        } END_TEST;
+
         TEST("random string inserts / reads")
         {
         //    char[]* strs = {"james", "anne", "viktor", "douglas", "bernie", ""} 
         } END_TEST;
         
-        // modl_map_print(map);
         modl_map_dispose(map);
+        free(map);
     } END_TEST;
 
     return 0;
@@ -0,0 +1,116 @@
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include <src/object.h>
+#include <src/pool.h>
+
+
+int test_object()
+{
+    TEST("object")
+    {
+        TEST("representation")
+        {
+            static int64_t const integers[] = {
+                0, 1, -1, 42, (INT64_C(1) << 47) - 1, -(INT64_C(1) << 47),
+                INT64_C(1) << 47, -(INT64_C(1) << 47) - 1, INT64_MAX, INT64_MIN,
+            };
+            int consistent = 1;
+            for (size_t i = 0; i < sizeof integers / sizeof integers[0]; ++i)
+            {
+                struct ModlObject a = modl_object_take(int_to_modl(integers[i]));
+                struct ModlObject b = modl_object_take(int_to_modl(integers[i]));
+                consistent &= modl_object_type_is(a, ModlTypeInteger) && integers[i] == modl_to_int(a);
+                consistent &= modl_object_equals(a, b) && 0 == modl_object_cmp(a, b);
+                consistent &= modl_object_hash(a) == modl_object_hash(b);
+                modl_object_release(a);
+                modl_object_release(b);
+            }
+            EXPECT(consistent, "integers keep their value, large ones too");
+
+            static double const floatings[] = { 0.0, -0.0, 1.5, -2.25, 1e300, -1e-300, INFINITY, -INFINITY };
+            consistent = 1;
+            for (size_t i = 0; i < sizeof floatings / sizeof floatings[0]; ++i)
+            {
+                struct ModlObject a = double_to_modl(floatings[i]);
+                consistent &= modl_object_type_is(a, ModlTypeFloating) && modl_object_is_value_type(a);
+                consistent &= 0 == memcmp(&floatings[i], &(double) { modl_to_double(a) }, sizeof (double));
+            }
+            EXPECT(consistent, "doubles keep their bits");
+
+            struct ModlObject nan = double_to_modl(-NAN);
+            EXPECT(modl_object_type_is(nan, ModlTypeFloating) && isnan(modl_to_double(nan)), "NaN stays a double");
+
+            EXPECT(modl_object_type_is(bool_to_modl(TRUE), ModlTypeBoolean) && modl_to_bool(bool_to_modl(TRUE))
+                   && not modl_to_bool(bool_to_modl(FALSE)), "booleans keep their value");
+
+            struct ModlObject zeroed;
+            memset(&zeroed, 0, sizeof zeroed);
+            EXPECT(modl_object_type_is(zeroed, ModlTypeNil), "zeroed object is nil");
+            EXPECT(modl_object_type_is(modl_unbound(), ModlTypeNil) && modl_object_is_unbound(modl_unbound())
+                   && not modl_object_is_unbound(modl_nil()), "unbound is a nil distinct from nil");
+
+            struct ModlObject str = modl_object_take(str_to_modl("text"));
+            struct ModlObject table = modl_table_new();
+            EXPECT(modl_object_type_is(str, ModlTypeString) && 0 == strcmp("text", modl_to_str(str))
+                   && modl_object_type_is(table, ModlTypeTable) && not modl_object_is_value_type(table),
+                   "references keep their type and address");
+            modl_object_release(str);
+            modl_object_release(table);
+        } END_TEST;
+
+        TEST("release queue")
+        {
+            struct ModlPoolStats before, after;
+            modl_pool_stats(&before);
+            modl_object_release_queue_init(4);
+
+            struct ModlObject outer = modl_table_new();
+            for (int64_t i = 0; i < 1000; ++i)
+            {
+                struct ModlObject inner = modl_table_with_capacity(0, 100);
+                modl_table_insert_kv(&inner, str_to_modl("v"), int_to_modl(i));
+                modl_table_push_v(&outer, inner);
+            }
+            modl_object_release(outer);
+
+            size_t const pending = modl_object_release_pending(0);
+            size_t const after_step = modl_object_release_pending(MODL_RELEASE_STEP);
+            EXPECT(1 == pending && 0 < after_step, "dead table is queued and disposed in steps");
+
+            struct ModlReleaseStats stats;
+            modl_object_release_queue_stats(&stats);
+            EXPECT(stats.released <= MODL_RELEASE_STEP, "a step releases no more than its budget");
+
+            EXPECT(0 == modl_object_release_pending(SIZE_MAX), "queue drains");
+
+            /* small tables released by a dispose are queued too */
+            struct ModlObject head = modl_table_new();
+            struct ModlObject link = head;
+            for (int i = 0; i < 200000; ++i)
+            {
+                struct ModlObject next = modl_table();
+                modl_table_insert_kv(&link, str_to_modl("next"), next);
+                link = next;
+            }
+            modl_object_release(head);
+            modl_object_release_queue_stats(&stats);
+            size_t const released = stats.released;
+            EXPECT(1 == modl_object_release_pending(0), "chain of small tables is queued past its head");
+
+            modl_object_release_pending(MODL_RELEASE_STEP);
+            modl_object_release_queue_stats(&stats);
+            EXPECT(stats.released - released <= MODL_RELEASE_STEP, "a step of the chain stays within budget");
+            EXPECT(0 == modl_object_release_pending(SIZE_MAX), "chain drains without recursion");
+            modl_object_release_queue_free();
+
+            modl_pool_stats(&after);
+            EXPECT(after.classes[0].used == before.classes[0].used, "queued tables are freed");
+        } END_TEST;
+    } END_TEST;
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include <src/pool.h>
+#include <src/object.h>
+
+
+int test_pool()
+{
+    TEST("pool")
+    {
+#ifndef MODL_NO_POOL
+        TEST("slabs")
+        {
+            struct ModlPoolStats before, after;
+            modl_pool_stats(&before);
+
+            void * a = modl_pool_alloc_ref();
+            void * b = modl_pool_alloc_ref();
+            char * s = modl_pool_alloc_string(20);
+            modl_pool_stats(&after);
+            EXPECT(after.classes[0].used == before.classes[0].used + 2
+                   && after.classes[2].used == before.classes[2].used + 1
+                   && after.classes[2].slot_size >= 20, "slots are taken from their class");
+
+            modl_pool_free_ref(a);
+            void * c = modl_pool_alloc_ref();
+            EXPECT(a == c, "freed slot is reused first");
+            modl_pool_free_ref(b);
+            modl_pool_free_ref(c);
+            modl_pool_free_string(s, 20);
+
+            char * large = modl_pool_alloc_string(MODL_POOL_STRING_MAX_SIZE + 1);
+            modl_pool_free_string(large, MODL_POOL_STRING_MAX_SIZE + 1);
+            modl_pool_stats(&after);
+            EXPECT(after.large_allocations == before.large_allocations + 1, "long strings use malloc");
+
+            int balanced = 1;
+            for (size_t i = 0; i < MODL_POOL_CLASSES; ++i)
+                balanced &= after.classes[i].used == before.classes[i].used;
+            EXPECT(balanced, "freed slots are no longer in use");
+        } END_TEST;
+#endif
+
+        TEST("strings")
+        {
+            struct ModlPoolStats before, after;
+            modl_pool_stats(&before);
+
+            char long_text[300];
+            memset(long_text, 'x', sizeof long_text - 1);
+            long_text[sizeof long_text - 1] = '\0';
+
+            struct ModlObject short_str = modl_object_take(str_to_modl("short"));
+            struct ModlObject long_str = modl_object_take(str_to_modl(long_text));
+            struct ModlObject joined = modl_object_take(str_concat_to_modl("ab", 2, "cd", 2));
+            EXPECT(0 == strcmp("abcd", modl_to_str(joined)) && 0 == strcmp(long_text, modl_to_str(long_str)),
+                   "pooled strings keep their text");
+
+            modl_object_release(short_str);
+            modl_object_release(long_str);
+            modl_object_release(joined);
+            modl_pool_stats(&after);
+            int balanced = 1;
+            for (size_t i = 0; i < MODL_POOL_CLASSES; ++i)
+                balanced &= after.classes[i].used == before.classes[i].used;
+            EXPECT(balanced, "released strings return their slots");
+        } END_TEST;
+
+#ifndef MODL_NO_POOL
+        TEST("regions")
+        {
+            struct ModlPoolStats before, after;
+            modl_pool_stats(&before);
+
+            struct ModlRegion * region = modl_pool_region_begin();
+            struct ModlObject dead = modl_object_take(str_to_modl("dead"));
+            struct ModlObject kept = modl_object_take(str_to_modl("kept"));
+            struct ModlObject table = modl_table_new();
+            modl_table_insert_kv(&table, str_to_modl("key"), str_to_modl("value"));
+            EXPECT(modl_pool_in_region(modl_to_ref(kept)) && modl_pool_in_region(modl_to_ref(table)),
+                   "objects come from the open region");
+            modl_object_release(dead);
+
+            modl_pool_region_leave(region);
+            kept = modl_object_promote(kept);
+            EXPECT(not modl_pool_in_region(modl_to_ref(kept)) && 0 == strcmp("kept", modl_to_str(kept)),
+                   "promoted object leaves the region");
+            modl_pool_region_end(region);
+            modl_pool_stats(&after);
+            EXPECT(after.region_deferred == before.region_deferred + 1, "live table defers the reset");
+
+            modl_object_release(table);
+            modl_object_release(kept);
+
+            region = modl_pool_region_begin();
+            struct ModlObject tmp = modl_object_take(str_to_modl("tmp"));
+            modl_object_release(tmp);
+            modl_pool_region_end(region);
+            modl_pool_stats(&after);
+            EXPECT(after.region_resets == before.region_resets + 1, "region without live objects is reset");
+
+            region = modl_pool_region_begin();
+            struct ModlRegion * inner = modl_pool_region_begin();
+            EXPECT(modl_pool_region_is_nested(inner) && not modl_pool_region_is_nested(region), "regions begun inside others are nested");
+            modl_pool_region_end(inner);
+            modl_pool_region_end(region);
+            modl_pool_stats(&after);
+
+            int balanced = 1;
+            for (size_t i = 0; i < MODL_POOL_CLASSES; ++i)
+                balanced &= after.classes[i].used == before.classes[i].used;
+            EXPECT(balanced, "promoted objects return their slots");
+        } END_TEST;
+
+        TEST("promoting tables")
+        {
+            struct ModlPoolStats before, after;
+            modl_pool_stats(&before);
+
+            struct ModlRegion * region = modl_pool_region_begin();
+            struct ModlObject outer = modl_table_new();
+            struct ModlObject inner = modl_table();
+            modl_table_push_v(&inner, str_to_modl("deep"));
+            modl_table_push_v(&outer, inner);
+            struct ModlObject shared = modl_object_take(str_to_modl("shared"));
+            modl_table_push_v(&outer, shared);
+
+            modl_pool_region_leave(region);
+            outer = modl_object_promote(outer);
+            inner = modl_table_get_v(&outer, int_to_modl(0));
+            struct ModlObject deep = modl_table_get_v(&inner, int_to_modl(0));
+            EXPECT(not modl_pool_in_region(modl_to_ref(inner)) && not modl_pool_in_region(modl_to_ref(deep))
+                   && 0 == strcmp("deep", modl_to_str(deep)),
+                   "entries only the table refers to leave the region with it");
+            EXPECT(modl_pool_in_region(modl_to_ref(modl_table_get_v(&outer, int_to_modl(1)))),
+                   "entries referred to elsewhere stay in the region");
+
+            modl_pool_region_end(region);
+            modl_pool_stats(&after);
+            EXPECT(after.region_deferred == before.region_deferred + 1, "shared entry defers the reset");
+
+            modl_object_release(shared);
+            modl_object_release(outer);
+            modl_pool_stats(&after);
+
+            int balanced = 1;
+            for (size_t i = 0; i < MODL_POOL_CLASSES; ++i)
+                balanced &= after.classes[i].used == before.classes[i].used;
+            EXPECT(balanced, "promoted tables return their slots");
+        } END_TEST;
+#endif
+    } END_TEST;
+
+    return 0;
+}
@@ -0,0 +1,480 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test.h"
+
+/* the virtual machine lives in the translation unit of the executable */
+#define main modl_program_main
+#include <src/program.c>
+#undef main
+
+
+static int64_t check_program_run(byte * code, size_t length)
+{
+    VM_SETTING_SILENT = TRUE;
+    struct Environment base_environment = { .nametable = modl_table_new() };
+    struct VMState vm = vm_create(&base_environment, 64, 128, 128);
+    struct ModlObject result = vm_execute(&vm, code, length);
+    int64_t const value = ModlTypeInteger == modl_object_type(result) ? modl_to_int(result) : -1;
+    vm_destroy(&vm, &base_environment);
+    return value;
+}
+
+static void check_program_dispose(struct Instruction * instructions, struct ConstantPool * pool)
+{
+    for (uint32_t i = 0; i < pool->count; ++i)
+        modl_object_release(pool->objects[i]);
+    free(pool->objects);
+    free(instructions);
+}
+
+int test_program()
+{
+    TEST("program")
+    {
+        TEST("tail calls")
+        {
+            /* f sets k = 42 and tail calls apply(g), where g returns k of f;
+               apply sets its own k = 7 before calling g */
+            byte code[] = {
+                OP_LOADFUN, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2e,   /* r0 = f */
+                OP_ENVSETC, 0x00, 0x06, 0x03, 0x01, 'f',
+                OP_LOADFUN, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40,   /* r0 = apply */
+                OP_ENVSETC, 0x00, 0x06, 0x03, 0x05, 'a', 'p', 'p', 'l', 'y',
+                OP_ENVGETC, 0x00, 0x06, 0x03, 0x01, 'f',
+                OP_CALLR, 0x00,
+                OP_NOP,
+                OP_RET,
+                /* f: */
+                OP_LOADC, 0x01, 0x03, 42,
+                OP_ENVSETC, 0x01, 0x06, 0x03, 0x01, 'k',
+                OP_LOADFUN, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x34,   /* r2 = g */
+                OP_ENVGETC, 0x03, 0x06, 0x03, 0x05, 'a', 'p', 'p', 'l', 'y',
+                OP_CALLW, 0x32, 0x01,                                               /* r3(r2) */
+                OP_RET,
+                /* apply: */
+                OP_ENVARGC, 0x00, 0x06, 0x03, 0x02, 'f', 'n',
+                OP_LOADC, 0x01, 0x03, 7,
+                OP_ENVSETC, 0x01, 0x06, 0x03, 0x01, 'k',
+                OP_ENVGETC, 0x00, 0x06, 0x03, 0x02, 'f', 'n',
+                OP_CALLR, 0x00,
+                OP_NOP,
+                OP_RET,
+                /* g: */
+                OP_ENVGETC, 0x00, 0x06, 0x03, 0x01, 'k',
+                OP_RET,
+            };
+            EXPECT(42 == check_program_run(code, sizeof code), "closure passed to a tail call keeps its environment");
+        } END_TEST;
+
+        TEST("regions")
+        {
+            /* f keeps a table of its region in r5 while g runs in a region of its own */
+            byte code[] = {
+                OP_LOADFUN, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3a,   /* r0 = g */
+                OP_ENVSETC, 0x00, 0x06, 0x03, 0x01, 'g',
+                OP_LOADFUN, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0e,   /* r0 = f */
+                OP_CALLR, 0x00,
+                OP_NOP,
+                OP_RET,
+                /* f: */
+                OP_REGION,
+                OP_LOADC, 0x05, 0x0a, 0x03, 0x00,
+                OP_LOADC, 0x01, 0x03, 0x01,
+                OP_TBLPUSH, 0x51,
+                OP_TBLPUSH, 0x51,
+                OP_ENVGETC, 0x06, 0x06, 0x03, 0x01, 'g',
+                OP_CALLR, 0x06,
+                OP_NOP,
+                OP_LEN, 0x05,
+                OP_MOV, 0x05,
+                OP_RET,
+                /* g: */
+                OP_REGION,
+                OP_LOADC, 0x01, 0x0a, 0x03, 0x00,
+                OP_RET,
+            };
+            EXPECT(2 == check_program_run(code, sizeof code), "values of the caller's region survive a nested region");
+        } END_TEST;
+
+        TEST("table iteration")
+        {
+            /* t holds 0 .. 99 in the array part and -1 .. -100 in the hash
+               part; visiting -i-1 removes it and the array key i, then a
+               second pass adds 1000 for every entry left */
+            byte code[] = {
+                OP_LOADC, 0x01, 0x0a, 0x03, 0x00,
+                OP_LOADC, 0x02, 0x03, 0x00,
+                OP_LOADC, 0x03, 0x03, 0x01,
+                OP_LOADC, 0x04, 0x03, 0x64,
+                OP_LOADC, 0x09, 0x03, 0x00,
+                OP_LOADC, 0x07, 0x03, 0x00,
+                /* fill: */
+                OP_MOV, 0x87,
+                OP_CMPLT, 0x84,
+                OP_JCF, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20,
+                OP_TBLPUSH, 0x17,
+                OP_MOV, 0x59,
+                OP_SUB, 0x53,
+                OP_SUB, 0x57,
+                OP_TBLSETR, 0x15, 0x07,
+                OP_ADD, 0x73,
+                OP_JMP, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xe5,
+                /* iterate: */
+                OP_TBLITER, 0x1a,
+                /* next: */
+                OP_TBLNEXT, 0x1a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x27,
+                OP_ADD, 0x23,
+                OP_MOV, 0x8b,
+                OP_CMPLT, 0x89,
+                OP_JCF, 0x08, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0,
+                OP_TBLDELR, 0x1b,
+                OP_TBLDELR, 0x1c,
+                OP_JMP, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xe2,
+                /* count: */
+                OP_LOADC, 0x05, 0x04, 0x00, 0x00, 0x03, 0xe8,
+                OP_TBLITER, 0x1a,
+                /* rest: */
+                OP_TBLNEXT, 0x1a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x15,
+                OP_ADD, 0x25,
+                OP_JMP, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf4,
+                /* done: */
+                OP_MOV, 0x02,
+                OP_RET,
+            };
+            EXPECT(200 == check_program_run(code, sizeof code), "removing during iteration visits every entry once");
+        } END_TEST;
+
+        TEST("environment caches")
+        {
+            /* f returns the global x unless its argument is set, then it binds
+               a local x first; the global is rebound before the last call */
+            byte code[] = {
+                OP_LOADC, 0x01, 0x03, 0x01,
+                OP_ENVSETC, 0x01, 0x06, 0x03, 0x01, 'x',
+                OP_LOADFUN, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x72,
+                OP_ENVSETC, 0x01, 0x06, 0x03, 0x01, 'f',
+                OP_LOADC, 0x05, 0x03, 0x00,
+                OP_LOADC, 0x06, 0x03, 0x00,
+                OP_LOADC, 0x07, 0x03, 0x03,
+                OP_LOADC, 0x08, 0x03, 0x01,
+                OP_LOADC, 0x02, 0x01,
+                /* loop: */
+                OP_ENVGETC, 0x03, 0x06, 0x03, 0x01, 'f',
+                OP_CALLW, 0x32, 0x01,
+                OP_ADD, 0x50,
+                OP_ADD, 0x68,
+                OP_MOV, 0x96,
+                OP_CMPLT, 0x97,
+                OP_JCT, 0x09, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xef,
+                OP_LOADC, 0x02, 0x02,
+                OP_ENVGETC, 0x03, 0x06, 0x03, 0x01, 'f',
+                OP_CALLW, 0x32, 0x01,
+                OP_ADD, 0x50,
+                OP_LOADC, 0x02, 0x01,
+                OP_ENVGETC, 0x03, 0x06, 0x03, 0x01, 'f',
+                OP_CALLW, 0x32, 0x01,
+                OP_ADD, 0x50,
+                OP_LOADC, 0x01, 0x03, 0x05,
+                OP_ENVSETC, 0x01, 0x06, 0x03, 0x01, 'x',
+                OP_ENVGETC, 0x03, 0x06, 0x03, 0x01, 'f',
+                OP_CALLW, 0x32, 0x01,
+                OP_ADD, 0x50,
+                OP_MOV, 0x05,
+                OP_RET,
+                /* f: */
+                OP_ENVARGC, 0x00, 0x06, 0x03, 0x01, 's',
+                OP_ENVGETC, 0x04, 0x06, 0x03, 0x01, 's',
+                OP_JCF, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x14,
+                OP_LOADC, 0x04, 0x03, 0x64,
+                OP_ENVSETC, 0x04, 0x06, 0x03, 0x01, 'x',
+                /* get: */
+                OP_ENVGETC, 0x00, 0x06, 0x03, 0x01, 'x',
+                OP_RET,
+            };
+            EXPECT(109 == check_program_run(code, sizeof code), "cached lookups see new bindings and shadowing names");
+        } END_TEST;
+
+        TEST("predecoded stream")
+        {
+            /* sums 3 + 2 + 1 in a loop, then jumps past the last instruction */
+            byte code[] = {
+                OP_LOADC, 0x01, 0x03, 0x03,
+                OP_LOADC, 0x02, 0x03, 0x00,
+                OP_LOADC, 0x03, 0x03, 0x01,
+                OP_LOADC, 0x05, 0x03, 0x00,
+                /* loop: */
+                OP_ADD, 0x21,
+                OP_SUB, 0x13,
+                OP_MOV, 0x41,
+                OP_CMPGT, 0x45,
+                OP_JCT, 0x04, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf8,
+                OP_MOV, 0x02,
+                OP_JMP, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0d,
+                OP_LOADC, 0x00, 0x03, 0x63,
+                /* end: */
+            };
+            size_t count = 0;
+            struct ConstantPool pool;
+            struct Instruction * instructions = translate_bytecode(code, sizeof code, &count, &pool);
+            EXPECT(13 == count, "one instruction per encoded one and a final OP_RET");
+            EXPECT(OP_ADD == instructions[4].opcode && 16 == instructions[4].offset, "instructions keep their bytecode offsets");
+            EXPECT(4 == instructions[8].a[1].i64, "backward jump targets an instruction index");
+            EXPECT(12 == instructions[10].a[0].i64 && OP_RET == instructions[12].opcode, "jump past the end targets the final OP_RET");
+            check_program_dispose(instructions, &pool);
+
+            EXPECT(6 == check_program_run(code, sizeof code), "predecoded program runs");
+        } END_TEST;
+
+        TEST("constant pool")
+        {
+            /* 0.0, -0.0, 0.0, 7, 7, 7.0, "ab", "ab", {}, {} */
+            byte code[] = {
+                OP_LOADC, 0x01, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                OP_LOADC, 0x02, 0x05, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                OP_LOADC, 0x03, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                OP_LOADC, 0x04, 0x03, 0x07,
+                OP_LOADC, 0x05, 0x03, 0x07,
+                OP_LOADC, 0x06, 0x05, 0x40, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                OP_LOADC, 0x07, 0x06, 0x03, 0x02, 0x61, 0x62,
+                OP_LOADC, 0x08, 0x06, 0x03, 0x02, 0x61, 0x62,
+                OP_LOADC, 0x09, 0x0a, 0x03, 0x00,
+                OP_LOADC, 0x0a, 0x0a, 0x03, 0x00,
+                OP_RET,
+            };
+            size_t count = 0;
+            struct ConstantPool pool;
+            struct Instruction * instructions = translate_bytecode(code, sizeof code, &count, &pool);
+            EXPECT(7 == pool.count, "equal constants share an entry");
+            EXPECT(instructions[0].a[1].constant == instructions[2].a[1].constant, "equal floats share an entry");
+            EXPECT(instructions[0].a[1].constant != instructions[1].a[1].constant, "0.0 and -0.0 are kept apart");
+            EXPECT(instructions[3].a[1].constant == instructions[4].a[1].constant, "equal integers share an entry");
+            EXPECT(ModlTypeFloating == modl_object_type(pool.objects[instructions[5].a[1].constant]), "7.0 is not merged with 7");
+            EXPECT(instructions[6].a[1].constant == instructions[7].a[1].constant, "equal strings share an entry");
+            EXPECT(instructions[8].a[1].constant != instructions[9].a[1].constant, "table templates are not shared");
+            check_program_dispose(instructions, &pool);
+        } END_TEST;
+
+        TEST("environment slots")
+        {
+            /* f(true) sets a, b and c, f(false) sets c and b only, so its a
+               is the global one: 1 + 2 + 3 + 100 + 20 + 30 */
+            byte code[] = {
+                OP_LOADC, 0x01, 0x03, 0x64,
+                OP_ENVSETC, 0x01, 0x06, 0x03, 0x01, 'a',
+                OP_LOADFUN, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2f,
+                OP_ENVSETC, 0x01, 0x06, 0x03, 0x01, 'f',
+                OP_LOADC, 0x02, 0x02,
+                OP_ENVGETC, 0x03, 0x06, 0x03, 0x01, 'f',
+                OP_CALLW, 0x32, 0x01,
+                OP_MOV, 0x60,
+                OP_LOADC, 0x02, 0x01,
+                OP_ENVGETC, 0x03, 0x06, 0x03, 0x01, 'f',
+                OP_CALLW, 0x32, 0x01,
+                OP_ADD, 0x60,
+                OP_MOV, 0x06,
+                OP_RET,
+                /* f: */
+                OP_ENVARGC, 0x00, 0x06, 0x03, 0x01, 's',
+                OP_ENVGETC, 0x04, 0x06, 0x03, 0x01, 's',
+                OP_JCF, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x31,
+                OP_LOADC, 0x04, 0x03, 0x01,
+                OP_ENVSETC, 0x04, 0x06, 0x03, 0x01, 'a',
+                OP_LOADC, 0x04, 0x03, 0x02,
+                OP_ENVSETC, 0x04, 0x06, 0x03, 0x01, 'b',
+                OP_LOADC, 0x04, 0x03, 0x03,
+                OP_ENVSETC, 0x04, 0x06, 0x03, 0x01, 'c',
+                OP_JMP, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1d,
+                /* other: */
+                OP_LOADC, 0x04, 0x03, 0x1e,
+                OP_ENVSETC, 0x04, 0x06, 0x03, 0x01, 'c',
+                OP_LOADC, 0x04, 0x03, 0x14,
+                OP_ENVSETC, 0x04, 0x06, 0x03, 0x01, 'b',
+                /* sum: */
+                OP_ENVGETC, 0x00, 0x06, 0x03, 0x01, 'a',
+                OP_ENVGETC, 0x04, 0x06, 0x03, 0x01, 'b',
+                OP_ADD, 0x04,
+                OP_ENVGETC, 0x04, 0x06, 0x03, 0x01, 'c',
+                OP_ADD, 0x04,
+                OP_RET,
+            };
+            VM_SETTING_SILENT = TRUE;
+            struct Environment base_environment = { .nametable = modl_table_new() };
+            struct VMState vm = vm_create(&base_environment, 64, 128, 128);
+            struct ModlObject result = vm_execute(&vm, code, sizeof code);
+            EXPECT(156 == modl_to_int(result), "names unset in an activation fall back to outer environments");
+
+            size_t nametables = 0, names = 0;
+            for (size_t i = 0; i < vm.code_length; ++i)
+            {
+                if (ModlTypeNil == modl_object_type(vm.nametables[i])) continue;
+                nametables += 1;
+                names = modl_to_ref(vm.nametables[i])->value.table.size;
+            }
+            EXPECT(1 == nametables && 4 == names, "activations of f share a nametable with one slot per name");
+            vm_destroy(&vm, &base_environment);
+        } END_TEST;
+
+        TEST("pooled environments")
+        {
+            /* f(true) binds a local x = 5, f(false) runs in the same pooled
+               environment and must see the global x = 200 */
+            byte code[] = {
+                OP_LOADC, 0x01, 0x03, 0xc8,
+                OP_ENVSETC, 0x01, 0x06, 0x03, 0x01, 'x',
+                OP_LOADFUN, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2f,
+                OP_ENVSETC, 0x01, 0x06, 0x03, 0x01, 'f',
+                OP_LOADC, 0x02, 0x02,
+                OP_ENVGETC, 0x03, 0x06, 0x03, 0x01, 'f',
+                OP_CALLW, 0x32, 0x01,
+                OP_MOV, 0x60,
+                OP_LOADC, 0x02, 0x01,
+                OP_ENVGETC, 0x03, 0x06, 0x03, 0x01, 'f',
+                OP_CALLW, 0x32, 0x01,
+                OP_ADD, 0x60,
+                OP_MOV, 0x06,
+                OP_RET,
+                /* f: */
+                OP_ENVARGC, 0x00, 0x06, 0x03, 0x01, 's',
+                OP_ENVGETC, 0x04, 0x06, 0x03, 0x01, 's',
+                OP_JCF, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x14,
+                OP_LOADC, 0x04, 0x03, 0x05,
+                OP_ENVSETC, 0x04, 0x06, 0x03, 0x01, 'x',
+                /* get: */
+                OP_ENVGETC, 0x00, 0x06, 0x03, 0x01, 'x',
+                OP_RET,
+            };
+            VM_SETTING_SILENT = TRUE;
+            struct Environment base_environment = { .nametable = modl_table_new() };
+            struct VMState vm = vm_create(&base_environment, 64, 128, 128);
+            struct ModlObject result = vm_execute(&vm, code, sizeof code);
+            EXPECT(205 == modl_to_int(result), "variables of an activation do not leak into the next one");
+            EXPECT(0 == vm.environments[1].next_variable_id && 0 < vm.environments[1].variables_capacity,
+                "released environment keeps its storage");
+            vm_destroy(&vm, &base_environment);
+        } END_TEST;
+
+        TEST("quickening")
+        {
+            /* r2 += r1 runs on integers three times, then r1 becomes 0.5 */
+            byte code[] = {
+                OP_LOADC, 0x01, 0x03, 0x01,
+                OP_LOADC, 0x02, 0x03, 0x00,
+                OP_LOADC, 0x03, 0x03, 0x00,
+                OP_LOADC, 0x04, 0x03, 0x04,
+                OP_LOADC, 0x05, 0x03, 0x01,
+                OP_LOADC, 0x07, 0x03, 0x03,
+                OP_LOADC, 0x08, 0x05, 0x3f, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                /* loop: */
+                OP_ADD, 0x21,
+                OP_ADD, 0x35,
+                OP_MOV, 0x63,
+                OP_CMPLT, 0x67,
+                OP_JCT, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c,
+                OP_MOV, 0x18,
+                /* next: */
+                OP_MOV, 0x63,
+                OP_CMPLT, 0x64,
+                OP_JCT, 0x06, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xe8,
+                OP_MOV, 0x02,
+                OP_RET,
+            };
+            VM_SETTING_SILENT = TRUE;
+            struct Environment base_environment = { .nametable = modl_table_new() };
+            struct VMState vm = vm_create(&base_environment, 64, 128, 128);
+            struct ModlObject result = vm_execute(&vm, code, sizeof code);
+            EXPECT(ModlTypeFloating == modl_object_type(result) && 3.5 == modl_to_double(result), "deoptimized site adds a float");
+            EXPECT(OP_ADD == vm.code[7].opcode && (vm.code[7].flags & INSTRUCTION_FLAG_GENERIC), "site hit by a float stays generic");
+            EXPECT(OP_ADD_II == vm.code[8].opcode && OP_CMPLT_II == vm.code[14].opcode, "integer-only sites stay quickened");
+            EXPECT(4 == vm.quickenings && 1 == vm.deoptimizations, "each site is quickened once");
+            vm_destroy(&vm, &base_environment);
+        } END_TEST;
+
+        TEST("call depth")
+        {
+            /* sum(n) = n + sum(n - 1) for n = 20000, calls nest in one run() */
+            byte code[] = {
+                OP_LOADFUN, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x25,
+                OP_ENVSETC, 0x01, 0x06, 0x03, 0x03, 's', 'u', 'm',
+                OP_LOADC, 0x04, 0x04, 0x00, 0x00, 0x4e, 0x20,
+                OP_ENVGETC, 0x06, 0x06, 0x03, 0x03, 's', 'u', 'm',
+                OP_CALLW, 0x64, 0x01,
+                OP_RET,
+                /* sum: */
+                OP_ENVARGC, 0x00, 0x06, 0x03, 0x01, 'n',
+                OP_ENVGETC, 0x01, 0x06, 0x03, 0x01, 'n',
+                OP_LOADC, 0x02, 0x03, 0x00,
+                OP_MOV, 0x31,
+                OP_CMPGT, 0x32,
+                OP_JCT, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f,
+                OP_LOADC, 0x00, 0x03, 0x00,
+                OP_RET,
+                /* rec: */
+                OP_MOV, 0x41,
+                OP_LOADC, 0x05, 0x03, 0x01,
+                OP_SUB, 0x45,
+                OP_ENVGETC, 0x06, 0x06, 0x03, 0x03, 's', 'u', 'm',
+                OP_CALLW, 0x64, 0x01,
+                OP_ENVGETC, 0x01, 0x06, 0x03, 0x01, 'n',
+                OP_ADD, 0x01,
+                OP_RET,
+            };
+            VM_SETTING_SILENT = TRUE;
+            struct Environment base_environment = { .nametable = modl_table_new() };
+            struct VMState vm = vm_create(&base_environment, 20016, 20016, 128);
+            struct ModlObject result = vm_execute(&vm, code, sizeof code);
+            EXPECT(200010000 == modl_to_int(result), "deep recursion is not bounded by the native stack");
+            EXPECT(0 == vm.csp && 0 == vm.sp, "returns pop every frame and argument");
+            vm_destroy(&vm, &base_environment);
+        } END_TEST;
+
+#ifndef MODL_NO_POOL
+        TEST("values escaping regions")
+        {
+            /* f(t) pushes a = {7} into t, then b, which a table of its own
+               region also holds */
+            byte code[] = {
+                OP_LOADC, 0x08, 0x0a, 0x03, 0x00,
+                OP_LOADFUN, 0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10,
+                OP_CALLW, 0x98, 0x01,
+                OP_MOV, 0x08,
+                OP_RET,
+                /* f: */
+                OP_REGION,
+                OP_ENVARGC, 0x00, 0x06, 0x03, 0x01, 't',
+                OP_ENVGETC, 0x01, 0x06, 0x03, 0x01, 't',
+                OP_LOADC, 0x02, 0x0a, 0x03, 0x00,
+                OP_LOADC, 0x03, 0x03, 0x07,
+                OP_TBLPUSH, 0x23,
+                OP_TBLPUSH, 0x12,
+                OP_LOADC, 0x04, 0x0a, 0x03, 0x00,
+                OP_LOADC, 0x05, 0x0a, 0x03, 0x00,
+                OP_TBLPUSH, 0x54,
+                OP_TBLPUSH, 0x14,
+                OP_LOADC, 0x00, 0x03, 0x00,
+                OP_RET,
+            };
+            struct ModlPoolStats before, after;
+            modl_pool_stats(&before);
+
+            VM_SETTING_SILENT = TRUE;
+            struct Environment base_environment = { .nametable = modl_table_new() };
+            struct VMState vm = vm_create(&base_environment, 64, 128, 128);
+            struct ModlObject result = vm_execute(&vm, code, sizeof code);
+            modl_pool_stats(&after);
+
+            struct ModlObject const a = modl_table_get_v(&result, int_to_modl(0));
+            struct ModlObject const b = modl_table_get_v(&result, int_to_modl(1));
+            EXPECT(not modl_pool_in_region(modl_to_ref(a)) && 7 == modl_to_int(modl_table_get_v(&a, int_to_modl(0))),
+                "value stored in a table of another region is promoted");
+            EXPECT(1 == vm.region_promotions, "only values with a single reference are promoted");
+            EXPECT(modl_pool_in_region(modl_to_ref(b)) && after.region_deferred == before.region_deferred + 1,
+                "value shared before it escaped keeps the region alive");
+            vm_destroy(&vm, &base_environment);
+        } END_TEST;
+#endif
+    } END_TEST;
+
+    return 0;
+}
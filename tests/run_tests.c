@@ -1,9 +1,19 @@
 #include "test.h"
 #include "check_map.c"
+#include "check_hash.c"
+#include "check_object.c"
+#include "check_pool.c"
+#include "check_collector.c"
+#include "check_program.c"
 
 int main()
 {
     test_map();
+    test_hash();
+    test_object();
+    test_pool();
+    test_collector();
+    test_program();
     
     // TEST("random")
     // {